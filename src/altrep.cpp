@@ -0,0 +1,417 @@
+#include <R_ext/Altrep.h>
+
+#include "altrep.h"
+#include "protect.h"
+
+extern "C" {
+SEXP nanoparquet_read(SEXP filesxp, SEXP colsel, SEXP rowgroups,
+                      SEXP skip, SEXP nmax, SEXP filter, SEXP factors,
+                      SEXP eager, SEXP options);
+}
+
+static R_altrep_class_t lazy_integer_class;
+static R_altrep_class_t lazy_real_class;
+static R_altrep_class_t lazy_logical_class;
+static R_altrep_class_t lazy_string_class;
+static R_altrep_class_t dict_integer_class;
+static R_altrep_class_t dict_real_class;
+static R_altrep_class_t dict_string_class;
+
+// data1 is the info list, see altrep.h, data2 is the column, once it
+// was read
+
+static R_xlen_t lazy_Length(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) {
+    return XLENGTH(data2);
+  }
+  return (R_xlen_t) REAL(VECTOR_ELT(R_altrep_data1(x), 6))[0];
+}
+
+static SEXP lazy_materialize(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) {
+    return data2;
+  }
+  SEXP info = R_altrep_data1(x);
+  SEXP res = PROTECT(nanoparquet_read(
+    VECTOR_ELT(info, 0),
+    VECTOR_ELT(info, 1),
+    VECTOR_ELT(info, 2),
+    VECTOR_ELT(info, 3),
+    VECTOR_ELT(info, 4),
+    R_NilValue,
+    R_NilValue,
+    R_NilValue,
+    VECTOR_ELT(info, 5)
+  ));
+  SEXP col = VECTOR_ELT(VECTOR_ELT(res, 0), 0);
+  if (TYPEOF(col) != TYPEOF(x) || XLENGTH(col) != lazy_Length(x)) {
+    Rf_error(
+      "Parquet file '%s' has changed since it was read",
+      CHAR(STRING_ELT(VECTOR_ELT(info, 0), 0))
+    );
+  }
+  R_set_altrep_data2(x, col);
+  // so read_stats shows what reading this column cost
+  SEXP ns = PROTECT(R_FindNamespace(Rf_mkString("nanoparquet")));
+  SEXP call = PROTECT(Rf_lang2(
+    Rf_install("record_read_stats"),
+    VECTOR_ELT(res, 3)
+  ));
+  Rf_eval(call, ns);
+  UNPROTECT(3);
+  return col;
+}
+
+static void *lazy_ptr(SEXP col) {
+  switch (TYPEOF(col)) {
+  case INTSXP:
+    return INTEGER(col);
+  case REALSXP:
+    return REAL(col);
+  case LGLSXP:
+    return LOGICAL(col);
+  case STRSXP:
+    return (void *) STRING_PTR_RO(col);
+  default:
+    Rf_error("nanoparquet: internal error, invalid lazy column");
+  }
+}
+
+static Rboolean lazy_Inspect(SEXP x, int pre, int deep, int pvec,
+                             void (*inspect_subtree)(SEXP, int, int, int)) {
+  SEXP info = R_altrep_data1(x);
+  Rprintf(
+    "nanoparquet lazy column %d of '%s' (%s)\n",
+    INTEGER(VECTOR_ELT(info, 1))[0],
+    CHAR(STRING_ELT(VECTOR_ELT(info, 0), 0)),
+    R_altrep_data2(x) == R_NilValue ? "not read" : "read"
+  );
+  return TRUE;
+}
+
+// We serialize the data itself, not the file name, the file might not
+// be there when the data is loaded.
+
+static SEXP lazy_Serialized_state(SEXP x) {
+  return lazy_materialize(x);
+}
+
+static SEXP lazy_Unserialize(SEXP cls, SEXP state) {
+  return state;
+}
+
+static void *lazy_Dataptr(SEXP x, Rboolean writeable) {
+  return lazy_ptr(lazy_materialize(x));
+}
+
+static const void *lazy_Dataptr_or_null(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  return data2 == R_NilValue ? NULL : lazy_ptr(data2);
+}
+
+static int lazy_No_NA(SEXP x) {
+  return LOGICAL(VECTOR_ELT(R_altrep_data1(x), 7))[0];
+}
+
+static int lazy_integer_Elt(SEXP x, R_xlen_t i) {
+  return INTEGER(lazy_materialize(x))[i];
+}
+
+static double lazy_real_Elt(SEXP x, R_xlen_t i) {
+  return REAL(lazy_materialize(x))[i];
+}
+
+static int lazy_logical_Elt(SEXP x, R_xlen_t i) {
+  return LOGICAL(lazy_materialize(x))[i];
+}
+
+static SEXP lazy_string_Elt(SEXP x, R_xlen_t i) {
+  return STRING_ELT(lazy_materialize(x), i);
+}
+
+static void lazy_string_Set_elt(SEXP x, R_xlen_t i, SEXP v) {
+  SET_STRING_ELT(lazy_materialize(x), i, v);
+}
+
+static void init_lazy_class(R_altrep_class_t cls) {
+  R_set_altrep_Length_method(cls, lazy_Length);
+  R_set_altrep_Inspect_method(cls, lazy_Inspect);
+  R_set_altrep_Serialized_state_method(cls, lazy_Serialized_state);
+  R_set_altrep_Unserialize_method(cls, lazy_Unserialize);
+  R_set_altvec_Dataptr_method(cls, lazy_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, lazy_Dataptr_or_null);
+}
+
+// data1 is the info list, see altrep.h, data2 is the expanded column,
+// if it was needed
+
+static R_xlen_t dict_Length(SEXP x) {
+  SEXP info = R_altrep_data1(x);
+  return XLENGTH(VECTOR_ELT(info, 1)) / INTEGER(VECTOR_ELT(info, 2))[0];
+}
+
+static inline uint32_t dict_index(SEXP info, R_xlen_t i) {
+  const Rbyte *idx = RAW(VECTOR_ELT(info, 1));
+  switch (INTEGER(VECTOR_ELT(info, 2))[0]) {
+  case 1:
+    return idx[i];
+  case 2:
+    return ((const uint16_t *) idx)[i];
+  default:
+    return ((const uint32_t *) idx)[i];
+  }
+}
+
+static SEXP dict_expand(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) {
+    return data2;
+  }
+  SEXP info = R_altrep_data1(x);
+  SEXP values = VECTOR_ELT(info, 0);
+  R_xlen_t len = dict_Length(x);
+  SEXP col = PROTECT(Rf_allocVector(TYPEOF(values), len));
+  switch (TYPEOF(values)) {
+  case INTSXP: {
+    int *vals = INTEGER(values), *out = INTEGER(col);
+    for (R_xlen_t i = 0; i < len; i++) {
+      uint32_t idx = dict_index(info, i);
+      out[i] = idx == 0 ? NA_INTEGER : vals[idx - 1];
+    }
+    break;
+  }
+  case REALSXP: {
+    double *vals = REAL(values), *out = REAL(col);
+    for (R_xlen_t i = 0; i < len; i++) {
+      uint32_t idx = dict_index(info, i);
+      out[i] = idx == 0 ? NA_REAL : vals[idx - 1];
+    }
+    break;
+  }
+  case STRSXP: {
+    for (R_xlen_t i = 0; i < len; i++) {
+      uint32_t idx = dict_index(info, i);
+      SET_STRING_ELT(col, i, idx == 0 ? NA_STRING : STRING_ELT(values, idx - 1));
+    }
+    break;
+  }
+  default:
+    Rf_error("nanoparquet: internal error, invalid dictionary column");
+  }
+  R_set_altrep_data2(x, col);
+  UNPROTECT(1);
+  return col;
+}
+
+static Rboolean dict_Inspect(SEXP x, int pre, int deep, int pvec,
+                             void (*inspect_subtree)(SEXP, int, int, int)) {
+  SEXP info = R_altrep_data1(x);
+  Rprintf(
+    "nanoparquet dictionary column, %d values, %d byte indices (%s)\n",
+    (int) XLENGTH(VECTOR_ELT(info, 0)),
+    INTEGER(VECTOR_ELT(info, 2))[0],
+    R_altrep_data2(x) == R_NilValue ? "compact" : "expanded"
+  );
+  return TRUE;
+}
+
+// The compact form is serialized, so the column stays compact when it
+// is loaded
+
+static SEXP dict_Serialized_state(SEXP x) {
+  return R_altrep_data1(x);
+}
+
+static SEXP dict_integer_Unserialize(SEXP cls, SEXP state) {
+  return R_new_altrep(dict_integer_class, state, R_NilValue);
+}
+
+static SEXP dict_real_Unserialize(SEXP cls, SEXP state) {
+  return R_new_altrep(dict_real_class, state, R_NilValue);
+}
+
+static SEXP dict_string_Unserialize(SEXP cls, SEXP state) {
+  return R_new_altrep(dict_string_class, state, R_NilValue);
+}
+
+static void *dict_Dataptr(SEXP x, Rboolean writeable) {
+  return lazy_ptr(dict_expand(x));
+}
+
+static const void *dict_Dataptr_or_null(SEXP x) {
+  SEXP data2 = R_altrep_data2(x);
+  return data2 == R_NilValue ? NULL : lazy_ptr(data2);
+}
+
+static int dict_No_NA(SEXP x) {
+  return LOGICAL(VECTOR_ELT(R_altrep_data1(x), 3))[0];
+}
+
+static int dict_integer_Elt(SEXP x, R_xlen_t i) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) return INTEGER(data2)[i];
+  SEXP info = R_altrep_data1(x);
+  uint32_t idx = dict_index(info, i);
+  return idx == 0 ? NA_INTEGER : INTEGER(VECTOR_ELT(info, 0))[idx - 1];
+}
+
+static double dict_real_Elt(SEXP x, R_xlen_t i) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) return REAL(data2)[i];
+  SEXP info = R_altrep_data1(x);
+  uint32_t idx = dict_index(info, i);
+  return idx == 0 ? NA_REAL : REAL(VECTOR_ELT(info, 0))[idx - 1];
+}
+
+static SEXP dict_string_Elt(SEXP x, R_xlen_t i) {
+  SEXP data2 = R_altrep_data2(x);
+  if (data2 != R_NilValue) return STRING_ELT(data2, i);
+  SEXP info = R_altrep_data1(x);
+  uint32_t idx = dict_index(info, i);
+  return idx == 0 ? NA_STRING : STRING_ELT(VECTOR_ELT(info, 0), idx - 1);
+}
+
+static void dict_string_Set_elt(SEXP x, R_xlen_t i, SEXP v) {
+  SET_STRING_ELT(dict_expand(x), i, v);
+}
+
+static R_xlen_t dict_integer_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+                                        int *buf) {
+  R_xlen_t len = dict_Length(x);
+  if (i + n > len) n = len - i;
+  for (R_xlen_t k = 0; k < n; k++) {
+    buf[k] = dict_integer_Elt(x, i + k);
+  }
+  return n;
+}
+
+static R_xlen_t dict_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+                                     double *buf) {
+  R_xlen_t len = dict_Length(x);
+  if (i + n > len) n = len - i;
+  for (R_xlen_t k = 0; k < n; k++) {
+    buf[k] = dict_real_Elt(x, i + k);
+  }
+  return n;
+}
+
+static void init_dict_class(R_altrep_class_t cls) {
+  R_set_altrep_Length_method(cls, dict_Length);
+  R_set_altrep_Inspect_method(cls, dict_Inspect);
+  R_set_altrep_Serialized_state_method(cls, dict_Serialized_state);
+  R_set_altvec_Dataptr_method(cls, dict_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, dict_Dataptr_or_null);
+}
+
+void init_altrep(DllInfo *dll) {
+  lazy_integer_class =
+    R_make_altinteger_class("lazy_integer", "nanoparquet", dll);
+  init_lazy_class(lazy_integer_class);
+  R_set_altinteger_Elt_method(lazy_integer_class, lazy_integer_Elt);
+  R_set_altinteger_No_NA_method(lazy_integer_class, lazy_No_NA);
+
+  lazy_real_class = R_make_altreal_class("lazy_real", "nanoparquet", dll);
+  init_lazy_class(lazy_real_class);
+  R_set_altreal_Elt_method(lazy_real_class, lazy_real_Elt);
+  R_set_altreal_No_NA_method(lazy_real_class, lazy_No_NA);
+
+  lazy_logical_class =
+    R_make_altlogical_class("lazy_logical", "nanoparquet", dll);
+  init_lazy_class(lazy_logical_class);
+  R_set_altlogical_Elt_method(lazy_logical_class, lazy_logical_Elt);
+  R_set_altlogical_No_NA_method(lazy_logical_class, lazy_No_NA);
+
+  lazy_string_class =
+    R_make_altstring_class("lazy_string", "nanoparquet", dll);
+  init_lazy_class(lazy_string_class);
+  R_set_altstring_Elt_method(lazy_string_class, lazy_string_Elt);
+  R_set_altstring_Set_elt_method(lazy_string_class, lazy_string_Set_elt);
+  R_set_altstring_No_NA_method(lazy_string_class, lazy_No_NA);
+
+  dict_integer_class =
+    R_make_altinteger_class("dict_integer", "nanoparquet", dll);
+  init_dict_class(dict_integer_class);
+  R_set_altrep_Unserialize_method(dict_integer_class, dict_integer_Unserialize);
+  R_set_altinteger_Elt_method(dict_integer_class, dict_integer_Elt);
+  R_set_altinteger_Get_region_method(dict_integer_class, dict_integer_Get_region);
+  R_set_altinteger_No_NA_method(dict_integer_class, dict_No_NA);
+
+  dict_real_class = R_make_altreal_class("dict_real", "nanoparquet", dll);
+  init_dict_class(dict_real_class);
+  R_set_altrep_Unserialize_method(dict_real_class, dict_real_Unserialize);
+  R_set_altreal_Elt_method(dict_real_class, dict_real_Elt);
+  R_set_altreal_Get_region_method(dict_real_class, dict_real_Get_region);
+  R_set_altreal_No_NA_method(dict_real_class, dict_No_NA);
+
+  dict_string_class =
+    R_make_altstring_class("dict_string", "nanoparquet", dll);
+  init_dict_class(dict_string_class);
+  R_set_altrep_Unserialize_method(dict_string_class, dict_string_Unserialize);
+  R_set_altstring_Elt_method(dict_string_class, dict_string_Elt);
+  R_set_altstring_Set_elt_method(dict_string_class, dict_string_Set_elt);
+  R_set_altstring_No_NA_method(dict_string_class, dict_No_NA);
+}
+
+struct lazy_column_data {
+  SEXP proto;
+  SEXP info;
+};
+
+static SEXP wrapped_lazy_column(void *data) {
+  lazy_column_data *d = (lazy_column_data *) data;
+  R_altrep_class_t cls;
+  switch (TYPEOF(d->proto)) {
+  case INTSXP:
+    cls = lazy_integer_class;
+    break;
+  case REALSXP:
+    cls = lazy_real_class;
+    break;
+  case LGLSXP:
+    cls = lazy_logical_class;
+    break;
+  case STRSXP:
+    cls = lazy_string_class;
+    break;
+  default:
+    Rf_error("nanoparquet: internal error, invalid lazy column type");
+  }
+  SEXP x = PROTECT(R_new_altrep(cls, d->info, R_NilValue));
+  Rf_copyMostAttrib(d->proto, x);
+  UNPROTECT(1);
+  return x;
+}
+
+SEXP safe_lazy_column(SEXP proto, SEXP info, SEXP *uwt) {
+  lazy_column_data d = { proto, info };
+  return R_UnwindProtect(wrapped_lazy_column, &d, throw_error, uwt, *uwt);
+}
+
+static SEXP wrapped_dict_column(void *data) {
+  lazy_column_data *d = (lazy_column_data *) data;
+  R_altrep_class_t cls;
+  switch (TYPEOF(d->proto)) {
+  case INTSXP:
+    cls = dict_integer_class;
+    break;
+  case REALSXP:
+    cls = dict_real_class;
+    break;
+  case STRSXP:
+    cls = dict_string_class;
+    break;
+  default:
+    Rf_error("nanoparquet: internal error, invalid dictionary column type");
+  }
+  SEXP x = PROTECT(R_new_altrep(cls, d->info, R_NilValue));
+  Rf_copyMostAttrib(d->proto, x);
+  UNPROTECT(1);
+  return x;
+}
+
+SEXP safe_dict_column(SEXP proto, SEXP info, SEXP *uwt) {
+  lazy_column_data d = { proto, info };
+  return R_UnwindProtect(wrapped_dict_column, &d, throw_error, uwt, *uwt);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+
+// Lazy columns are ALTREP vectors that only record how to read the
+// column. The column is read from the Parquet file when its data is
+// first needed. `proto` is a zero length vector with the type and the
+// attributes of the column. `info` is a list:
+// 1. file name,
+// 2. 1-based column index (integer scalar),
+// 3. row groups, as for nanoparquet_read(),
+// 4. skip,
+// 5. n_max,
+// 6. options, with lazy = FALSE,
+// 7. length of the column (double scalar),
+// 8. whether the metadata shows that there are no missing values.
+
+SEXP safe_lazy_column(SEXP proto, SEXP info, SEXP *uwt);
+
+// Dictionary columns are ALTREP vectors that store the distinct values
+// of a column, and an index for each row, in 1, 2 or 4 bytes. The
+// index is 1-based, 0 means NA. `proto` is a zero length vector with
+// the type and the attributes of the column. `info` is a list:
+// 1. the distinct values, a vector of the same type as `proto`,
+// 2. the indices, a raw vector,
+// 3. the size of an index in bytes (integer scalar),
+// 4. whether there are no missing values.
+
+SEXP safe_dict_column(SEXP proto, SEXP info, SEXP *uwt);
+
+void init_altrep(DllInfo *dll);
@@ -51,23 +51,29 @@ public:
     return total_value_count;
   }
 
-  inline uint8_t *decode(T *values) {
+  // We decode in place, without allocating memory. The deltas are
+  // unpacked right into `values` and then summed up in place.
+  inline uint8_t *decode(T *values_out) {
     if (total_value_count == 0) return buf->start;
+    // unsigned, so overflow wraps around
+    Tunsigned *values = (Tunsigned *) values_out;
     values[0] = first_value;
     values++;
     uint64_t todo = total_value_count - 1;
     while (todo > 0) {
       // start of a block
-      T min_delta = zigzag_decode<T, Tunsigned>(uleb_decode<Tunsigned>(buf));
+      Tunsigned min_delta = zigzag_decode<T, Tunsigned>(uleb_decode<Tunsigned>(buf));
       if (buf->len < mini_blocks_per_block) {
         throw runtime_error("End of buffer while DBP decoding");
       }
-      vector<uint8_t> bit_widths(mini_blocks_per_block);
-      memcpy(bit_widths.data(), buf->start, mini_blocks_per_block);
+      const uint8_t *bit_widths = buf->start;
       buf->start += mini_blocks_per_block; buf->len -= mini_blocks_per_block;
       for (auto i = 0; todo > 0 && i < mini_blocks_per_block; i++) {
         // start of a miniblock
-        int8_t bw = bit_widths[i];
+        uint8_t bw = bit_widths[i];
+        if (bw > sizeof(Tunsigned) * 8) {
+          throw runtime_error("Invalid bit width while DBP decoding");
+        }
         uint64_t mb_vals = values_per_mini_block > todo ? todo : values_per_mini_block;
         uint64_t mb_full_len = bw * values_per_mini_block / 8;
         uint64_t mb_len = bw * mb_vals / 8 + ((bw * mb_vals) % 8 > 0);
@@ -78,13 +84,11 @@ public:
           buf->start,
           mb_len,
           bw,
-          (Tunsigned*) values,
+          values,
           mb_vals
         );
-        for (auto i = 0; i < mb_vals; i++) {
-          *values = *(values-1) + *values + min_delta;
-          values++;
-        }
+        delta_prefix_sum<Tunsigned>(values, mb_vals, min_delta);
+        values += mb_vals;
         // we always need to add the full length here, because for
         // DELTA_LENGTH_BYTE_ARRAY encoded pages that's how much padding
         // we have before the string data.
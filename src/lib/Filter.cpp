@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "nanoparquet.h"
+#include "Filter.h"
+#include "zstd/common/xxhash.h"
+
+using namespace nanoparquet;
+using namespace parquet;
+
+ValueStats nanoparquet::column_chunk_stats(const ColumnMetaData &cmd) {
+  ValueStats st;
+  st.num_values = cmd.num_values;
+  if (!cmd.__isset.statistics) return st;
+  const Statistics &s = cmd.statistics;
+  if (s.__isset.null_count) {
+    st.has_null_count = true;
+    st.null_count = s.null_count;
+  }
+  if (s.__isset.min_value && s.__isset.max_value) {
+    st.has_min_max = true;
+    st.min = s.min_value;
+    st.max = s.max_value;
+  } else if (s.__isset.min && s.__isset.max &&
+             cmd.type != Type::BYTE_ARRAY &&
+             cmd.type != Type::FIXED_LEN_BYTE_ARRAY) {
+    // The deprecated fields use signed comparison, this is only right
+    // for numbers. (We don't filter on unsigned columns.)
+    st.has_min_max = true;
+    st.min = s.min;
+    st.max = s.max;
+  }
+  return st;
+}
+
+// decode a PLAIN encoded statistics value, false if it is not valid
+
+static bool stat_to_double(Type::type type, const std::string &v,
+                           double &out) {
+  switch (type) {
+  case Type::BOOLEAN:
+    if (v.size() < 1) return false;
+    out = v[0] != 0;
+    return true;
+  case Type::INT32: {
+    int32_t x;
+    if (v.size() != sizeof(x)) return false;
+    memcpy(&x, v.data(), sizeof(x));
+    out = x;
+    return true;
+  }
+  case Type::INT64: {
+    int64_t x;
+    if (v.size() != sizeof(x)) return false;
+    memcpy(&x, v.data(), sizeof(x));
+    out = x;
+    return true;
+  }
+  case Type::FLOAT: {
+    float x;
+    if (v.size() != sizeof(x)) return false;
+    memcpy(&x, v.data(), sizeof(x));
+    out = x;
+    return !std::isnan(out);
+  }
+  case Type::DOUBLE: {
+    double x;
+    if (v.size() != sizeof(x)) return false;
+    memcpy(&x, v.data(), sizeof(x));
+    out = x;
+    return !std::isnan(out);
+  }
+  default:
+    return false;
+  }
+}
+
+template <class T>
+static bool range_may_match(FilterOp op, const std::vector<T> &values,
+                            const T &min, const T &max) {
+  switch (op) {
+  case FilterOp::EQ:
+    return !(values[0] < min) && !(max < values[0]);
+  case FilterOp::NE:
+    return !(min == values[0] && max == values[0]);
+  case FilterOp::LT:
+    return min < values[0];
+  case FilterOp::LE:
+    return !(values[0] < min);
+  case FilterOp::GT:
+    return values[0] < max;
+  case FilterOp::GE:
+    return !(max < values[0]);
+  case FilterOp::IN: {
+    // values are sorted, is there one in [min, max]?
+    auto it = std::lower_bound(values.begin(), values.end(), min);
+    return it != values.end() && !(max < *it);
+  }
+  default:
+    return true;
+  }
+}
+
+bool nanoparquet::stats_may_match(const Predicate &pred,
+                                  const ValueStats &stats) {
+  bool is_float = pred.type == Type::FLOAT || pred.type == Type::DOUBLE;
+  bool all_null = stats.has_null_count && stats.num_values >= 0 &&
+    stats.null_count == stats.num_values;
+  bool no_null = stats.has_null_count && stats.null_count == 0;
+
+  if (pred.op == FilterOp::IS_NA) {
+    // NaN is NA in R, and it is not counted in null_count
+    return !no_null || is_float;
+  }
+  if (pred.op == FilterOp::NOT_NA) {
+    return !all_null;
+  }
+  if (pred.op == FilterOp::IN && pred.match_na && !no_null) {
+    return true;
+  }
+  // NaN values (and R's NA, if it was written as a value) are not in
+  // the statistics
+  if (pred.op == FilterOp::IN && is_float &&
+      (pred.match_na || pred.match_nan)) {
+    return true;
+  }
+  if (all_null) {
+    return false;
+  }
+  if (!stats.has_min_max) {
+    return true;
+  }
+  if (pred.op == FilterOp::IN && pred.num_values.empty() &&
+      pred.str_values.empty()) {
+    return false;
+  }
+
+  if (pred.type == Type::BYTE_ARRAY ||
+      pred.type == Type::FIXED_LEN_BYTE_ARRAY) {
+    // std::string compares bytes as unsigned char, which is the
+    // Parquet order for strings
+    return range_may_match(pred.op, pred.str_values, stats.min, stats.max);
+  } else {
+    double min, max;
+    if (!stat_to_double(pred.type, stats.min, min) ||
+        !stat_to_double(pred.type, stats.max, max)) {
+      return true;
+    }
+    return range_may_match(pred.op, pred.num_values, min, max);
+  }
+}
+
+// Split block bloom filter, see BloomFilter.md in the Parquet format
+// repository. The filter is a sequence of 256 bit blocks, the upper 32
+// bits of the hash select the block, the lower 32 bits set one bit in
+// each of the eight 32 bit words of the block.
+
+static bool bloom_check(const uint8_t *bitset, uint32_t len, uint64_t hash) {
+  static const uint32_t salt[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+  };
+  uint64_t num_blocks = len / 32;
+  uint64_t block_idx = ((hash >> 32) * num_blocks) >> 32;
+  const uint8_t *block = bitset + block_idx * 32;
+  uint32_t key = (uint32_t) hash;
+  for (int i = 0; i < 8; i++) {
+    uint32_t word;
+    memcpy(&word, block + i * 4, sizeof(word));
+    uint32_t mask = 1U << ((key * salt[i]) >> 27);
+    if (!(word & mask)) return false;
+  }
+  return true;
+}
+
+// values are hashed in their PLAIN encoding, without the length for
+// BYTE_ARRAY
+static bool bloom_probe(const uint8_t *bitset, uint32_t len,
+                        const void *value, size_t size) {
+  return bloom_check(bitset, len, zstd::XXH64(value, size, 0));
+}
+
+bool nanoparquet::bloom_filter_may_match(const Predicate &pred,
+                                         const uint8_t *bitset,
+                                         uint32_t len) {
+  if ((pred.op != FilterOp::EQ && pred.op != FilterOp::IN) ||
+      len < 32 || len % 32 != 0) {
+    return true;
+  }
+  switch (pred.type) {
+  case Type::BYTE_ARRAY:
+    for (auto &v : pred.str_values) {
+      if (bloom_probe(bitset, len, v.data(), v.size())) return true;
+    }
+    return false;
+  case Type::INT32:
+    for (auto v : pred.num_values) {
+      // other values cannot be in the column
+      if (v != std::trunc(v) || v < INT32_MIN || v > INT32_MAX) continue;
+      int32_t x = v;
+      if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+    }
+    return false;
+  case Type::INT64:
+    for (auto v : pred.num_values) {
+      if (v != std::trunc(v) || v < -9223372036854775808.0 ||
+          v >= 9223372036854775808.0) {
+        continue;
+      }
+      int64_t x = v;
+      if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+    }
+    return false;
+  case Type::FLOAT:
+    for (auto v : pred.num_values) {
+      float x = v;
+      if ((double) x != v) continue;
+      if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+      // -0.0 == 0.0, but they have different hashes
+      if (x == 0) {
+        x = -x;
+        if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+      }
+    }
+    return false;
+  case Type::DOUBLE:
+    for (auto v : pred.num_values) {
+      double x = v;
+      if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+      if (x == 0) {
+        x = -x;
+        if (bloom_probe(bitset, len, &x, sizeof(x))) return true;
+      }
+    }
+    return false;
+  default:
+    return true;
+  }
+}
+
+bool nanoparquet::predicate_matches_na(const Predicate &pred) {
+  return pred.op == FilterOp::IS_NA ||
+    (pred.op == FilterOp::IN && pred.match_na);
+}
+
+// R's NA is a NaN with 1954 in the low word, other NaN values are NaN
+// in R, and `NaN %in% NA` is FALSE
+static bool is_r_na(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return std::isnan(x) && (uint32_t) bits == 1954;
+}
+
+template <class T>
+static void evaluate_num(const Predicate &pred, const T *data,
+                         const uint64_t *defined, uint64_t from, uint64_t to,
+                         uint8_t *keep) {
+  const std::vector<double> &values = pred.num_values;
+  double v0 = values.empty() ? NAN : values[0];
+  bool na_match = predicate_matches_na(pred);
+  for (uint64_t i = from; i < to; i++) {
+    if (!keep[i]) continue;
+    if (defined && !bitmap_get(defined, i)) {
+      keep[i] = na_match;
+      continue;
+    }
+    double x = data[i];
+    bool res;
+    switch (pred.op) {
+    case FilterOp::EQ: res = x == v0; break;
+    // NaN != 5 is NA in R
+    case FilterOp::NE: res = x != v0 && !std::isnan(x); break;
+    case FilterOp::LT: res = x < v0; break;
+    case FilterOp::LE: res = x <= v0; break;
+    case FilterOp::GT: res = x > v0; break;
+    case FilterOp::GE: res = x >= v0; break;
+    case FilterOp::IN:
+      if (std::isnan(x)) {
+        res = is_r_na(x) ? pred.match_na : pred.match_nan;
+      } else {
+        res = std::binary_search(values.begin(), values.end(), x);
+      }
+      break;
+    case FilterOp::IS_NA: res = std::isnan(x); break;
+    case FilterOp::NOT_NA: res = !std::isnan(x); break;
+    default: res = true; break;
+    }
+    keep[i] = res;
+  }
+}
+
+static int compare_str(const char *p, uint32_t len, const std::string &s) {
+  int c = memcmp(p, s.data(), std::min((size_t) len, s.size()));
+  if (c != 0) return c;
+  return len < s.size() ? -1 : (len > s.size() ? 1 : 0);
+}
+
+typedef std::pair<uint32_t, const char *> str;
+
+// `get(i)` returns value i, from a dictionary, or from a ResultColumn
+template <class G>
+static void evaluate_str(const Predicate &pred, G get,
+                         const uint64_t *defined, uint64_t from, uint64_t to,
+                         uint8_t *keep) {
+  const std::vector<std::string> &values = pred.str_values;
+  bool na_match = predicate_matches_na(pred);
+  for (uint64_t i = from; i < to; i++) {
+    if (!keep[i]) continue;
+    if (defined && !bitmap_get(defined, i)) {
+      keep[i] = na_match;
+      continue;
+    }
+    const str x = get(i);
+    bool res;
+    if (pred.op == FilterOp::IN) {
+      auto it = std::lower_bound(
+        values.begin(), values.end(), x,
+        [](const std::string &v, const str &x) {
+          return compare_str(x.second, x.first, v) > 0;
+        });
+      res = it != values.end() && compare_str(x.second, x.first, *it) == 0;
+    } else if (pred.op == FilterOp::IS_NA) {
+      res = false;
+    } else if (pred.op == FilterOp::NOT_NA) {
+      res = true;
+    } else {
+      int c = compare_str(x.second, x.first, values[0]);
+      switch (pred.op) {
+      case FilterOp::EQ: res = c == 0; break;
+      case FilterOp::NE: res = c != 0; break;
+      case FilterOp::LT: res = c < 0; break;
+      case FilterOp::LE: res = c <= 0; break;
+      case FilterOp::GT: res = c > 0; break;
+      case FilterOp::GE: res = c >= 0; break;
+      default: res = true; break;
+      }
+    }
+    keep[i] = res;
+  }
+}
+
+void nanoparquet::evaluate_predicate(const Predicate &pred,
+                                     const void *values,
+                                     const uint64_t *defined,
+                                     uint64_t from, uint64_t to,
+                                     uint8_t *keep) {
+  switch (pred.type) {
+  case Type::BOOLEAN:
+    evaluate_num(pred, (const bool *) values, defined, from, to, keep);
+    break;
+  case Type::INT32:
+    evaluate_num(pred, (const int32_t *) values, defined, from, to, keep);
+    break;
+  case Type::INT64:
+    evaluate_num(pred, (const int64_t *) values, defined, from, to, keep);
+    break;
+  case Type::FLOAT:
+    evaluate_num(pred, (const float *) values, defined, from, to, keep);
+    break;
+  case Type::DOUBLE:
+    evaluate_num(pred, (const double *) values, defined, from, to, keep);
+    break;
+  case Type::BYTE_ARRAY:
+  case Type::FIXED_LEN_BYTE_ARRAY: {
+    auto data = (const std::pair<uint32_t, char *> *) values;
+    evaluate_str(pred, [&](uint64_t i) { return str(data[i]); },
+                 defined, from, to, keep);
+    break;
+  }
+  default:
+    throw std::runtime_error("Cannot filter on INT96 columns");
+  }
+}
+
+void nanoparquet::evaluate_predicate(const Predicate &pred,
+                                     const ResultColumn &col,
+                                     uint64_t from, uint64_t to,
+                                     uint8_t *keep) {
+  const uint64_t *defined = col.defined_bits();
+  if (pred.type == Type::BYTE_ARRAY ||
+      pred.type == Type::FIXED_LEN_BYTE_ARRAY) {
+    evaluate_str(pred, [&](uint64_t i) {
+      return str(col.str_len(i), col.str_ptr(i));
+    }, defined, from, to, keep);
+  } else {
+    evaluate_predicate(pred, col.data.ptr, defined, from, to, keep);
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parquet/parquet_types.h"
+
+namespace nanoparquet {
+
+struct ResultColumn;
+
+enum class FilterOp { EQ, NE, LT, LE, GT, GE, IN, IS_NA, NOT_NA };
+
+// A predicate on a leaf column, a filter is a conjunction of these.
+// Values of numeric and BOOLEAN columns are in num_values, in the
+// physical units of the column (e.g. milliseconds for a TIMESTAMP
+// column with MILLIS units), BYTE_ARRAY and FIXED_LEN_BYTE_ARRAY values
+// are in str_values. For IN the values are sorted. match_na means that
+// IN also matches missing values (and R's NA bit pattern), match_nan
+// that it matches NaN values, like `%in%` in R.
+struct Predicate {
+  uint64_t column;
+  parquet::Type::type type;
+  FilterOp op;
+  std::vector<double> num_values;
+  std::vector<std::string> str_values;
+  bool match_na = false;
+  bool match_nan = false;
+};
+
+// What we know about the values of a column chunk, or a page
+struct ValueStats {
+  bool has_min_max = false;
+  // PLAIN encoded, without a length prefix for BYTE_ARRAY
+  std::string min;
+  std::string max;
+  bool has_null_count = false;
+  int64_t null_count = 0;
+  // number of values, including nulls, -1 if unknown
+  int64_t num_values = -1;
+};
+
+ValueStats column_chunk_stats(const parquet::ColumnMetaData &cmd);
+
+// false if no value described by stats can satisfy the predicate
+bool stats_may_match(const Predicate &pred, const ValueStats &stats);
+
+// false if the split block bloom filter (without its header) shows
+// that no value of an EQ or IN predicate is in the column chunk
+bool bloom_filter_may_match(const Predicate &pred, const uint8_t *bitset,
+                            uint32_t len);
+
+// true if missing values satisfy the predicate
+bool predicate_matches_na(const Predicate &pred);
+
+// Evaluate a predicate for rows [from, to) of a decoded column, and
+// clear keep[i] for the rows that do not satisfy it.
+void evaluate_predicate(const Predicate &pred, const ResultColumn &col,
+                        uint64_t from, uint64_t to, uint8_t *keep);
+
+// Same, for the entries of a dictionary, these are in the layout of
+// ResultColumn::data, except that strings are (length, pointer) pairs.
+// defined is a bitmap, see bitmap.h, or nullptr, if all values are present.
+void evaluate_predicate(const Predicate &pred, const void *values,
+                        const uint64_t *defined, uint64_t from, uint64_t to,
+                        uint8_t *keep);
+
+} // namespace nanoparquet
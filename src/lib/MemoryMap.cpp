@@ -0,0 +1,103 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "MemoryMap.h"
+
+using namespace nanoparquet;
+
+#ifdef _WIN32
+
+bool MemoryMap::open(const std::string &filename, uint64_t size) {
+  close();
+  if (size == 0) return false;
+  HANDLE fh = CreateFileA(
+    filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, NULL
+  );
+  if (fh == INVALID_HANDLE_VALUE) return false;
+  HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mh == NULL) {
+    CloseHandle(fh);
+    return false;
+  }
+  void *p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+  if (p == NULL) {
+    CloseHandle(mh);
+    CloseHandle(fh);
+    return false;
+  }
+  file_handle = fh;
+  map_handle = mh;
+  ptr = (const char *) p;
+  len = size;
+  return true;
+}
+
+void MemoryMap::will_need(uint64_t, uint64_t) {
+  // PrefetchVirtualMemory() needs Windows 8, we don't bother
+}
+
+void MemoryMap::close() {
+  if (ptr != nullptr) {
+    UnmapViewOfFile(ptr);
+    ptr = nullptr;
+  }
+  if (map_handle != nullptr) {
+    CloseHandle((HANDLE) map_handle);
+    map_handle = nullptr;
+  }
+  if (file_handle != nullptr) {
+    CloseHandle((HANDLE) file_handle);
+    file_handle = nullptr;
+  }
+  len = 0;
+}
+
+#else
+
+bool MemoryMap::open(const std::string &filename, uint64_t size) {
+  close();
+  if (size == 0) return false;
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+  void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps the file open, we don't need the descriptor
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+#ifdef POSIX_MADV_SEQUENTIAL
+  // we typically read whole column chunks sequentially
+  posix_madvise(p, size, POSIX_MADV_SEQUENTIAL);
+#endif
+  ptr = (const char *) p;
+  len = size;
+  return true;
+}
+
+void MemoryMap::will_need(uint64_t offset, uint64_t size) {
+#ifdef POSIX_MADV_WILLNEED
+  if (ptr == nullptr || offset >= len) return;
+  if (size > len - offset) size = len - offset;
+  // the address must be page aligned
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t start = offset - offset % page_size;
+  posix_madvise((void *) (ptr + start), size + offset - start,
+                POSIX_MADV_WILLNEED);
+#endif
+}
+
+void MemoryMap::close() {
+  if (ptr != nullptr) {
+    munmap((void *) ptr, len);
+    ptr = nullptr;
+  }
+  len = 0;
+}
+
+#endif
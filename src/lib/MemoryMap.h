@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace nanoparquet {
+
+// Read-only memory mapping of a whole file. open() returns false if
+// the file cannot be mapped, the caller should then fall back to
+// regular reads.
+
+class MemoryMap {
+public:
+  MemoryMap() { }
+  ~MemoryMap() { close(); }
+  MemoryMap(const MemoryMap &) = delete;
+  MemoryMap &operator=(const MemoryMap &) = delete;
+
+  bool open(const std::string &filename, uint64_t size);
+  void close();
+  bool is_open() const { return ptr != nullptr; }
+  const char *data() const { return ptr; }
+  // hint that we'll read these bytes soon, so the OS can read them ahead
+  void will_need(uint64_t offset, uint64_t size);
+  uint64_t size() const { return len; }
+
+private:
+  const char *ptr = nullptr;
+  uint64_t len = 0;
+#ifdef _WIN32
+  void *file_handle = nullptr;
+  void *map_handle = nullptr;
+#endif
+};
+
+} // namespace nanoparquet
@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <math.h>
 #include <sstream>
 #include <string>
@@ -26,6 +29,38 @@ using namespace nanoparquet;
 
 static TCompactProtocolFactoryT<TMemoryBuffer> tproto_factory;
 
+// add [from, to) to a sorted list of row ranges, ranges are
+// added in increasing order
+static void add_row_range(vector<RowRange> &ranges, uint64_t from,
+                          uint64_t to) {
+  if (!ranges.empty() && ranges.back().to == from) {
+    ranges.back().to = to;
+  } else {
+    ranges.push_back({ from, to });
+  }
+}
+
+void ResultColumn::reserve_str(uint64_t len) {
+  if (strings_len + len > strings.len) {
+    strings.resize(std::max(strings_len + len, 2 * strings.len));
+  }
+}
+
+char *ResultColumn::add_str(uint64_t row, uint32_t len) {
+  reserve_str(len);
+  int64_t *offsets = (int64_t *) data.ptr;
+  while (strings_row < row) offsets[++strings_row] = strings_len;
+  char *ptr = strings.ptr + strings_len;
+  strings_len += len;
+  offsets[++strings_row] = strings_len;
+  return ptr;
+}
+
+void ResultColumn::finish_str(uint64_t num_rows) {
+  int64_t *offsets = (int64_t *) data.ptr;
+  while (strings_row < num_rows) offsets[++strings_row] = strings_len;
+}
+
 template <class T>
 static void thrift_unpack(const uint8_t *buf, uint32_t *len,
                           T *deserialized_msg, string &filename) {
@@ -44,11 +79,12 @@ static void thrift_unpack(const uint8_t *buf, uint32_t *len,
   *len = *len - bytes_left;
 }
 
-ParquetFile::ParquetFile(std::string filename): filename(filename) {
-  initialize(filename);
+ParquetFile::ParquetFile(std::string filename, bool use_mmap)
+  : filename(filename) {
+  initialize(filename, use_mmap);
 }
 
-void ParquetFile::initialize(string filename) {
+void ParquetFile::initialize(string filename, bool use_mmap) {
   ByteBuffer buf;
   pfile.open(filename, std::ios::binary);
   if (pfile.fail()) {
@@ -105,6 +141,16 @@ void ParquetFile::initialize(string filename) {
 
   thrift_unpack((const uint8_t *)buf.ptr, (uint32_t *)&footer_len,
                 &file_meta_data, filename);
+
+  // If the mapping works, we don't need the stream any more. Otherwise
+  // silently fall back to reading from the stream.
+  if (use_mmap && mmap_file.open(filename, file_size)) {
+    pfile.close();
+  } else {
+    // column chunks are read with positional reads, from multiple
+    // threads, if possible
+    rafile.open(filename);
+  }
   // skip the first column its the root and otherwise useless
   for (uint64_t col_idx = 1; col_idx < file_meta_data.schema.size();
        col_idx++) {
@@ -178,7 +224,18 @@ public:
   uint64_t page_buf_len = 0;
   uint64_t page_start_row = 0;
 
-  uint8_t *defined_ptr;
+  // the definition levels of the column chunk, a bitmap, see bitmap.h
+  uint64_t *defined = nullptr;
+  // number of missing values in the current data page
+  uint32_t null_count = 0;
+  // the dictionary strings of the current page point into the page
+  // buffer, so it must live as long as the ResultColumn dictionary
+  bool page_buf_kept = false;
+  // long runs of dictionary indices in the current data page, from
+  // RleBpDecoder::GetBatch()
+  std::vector<RleRun> dict_runs;
+  // if not nullptr, then we only need the values of these rows
+  const uint8_t *wanted = nullptr;
 
   // for FIXED_LEN_BYTE_ARRAY
   int32_t type_len;
@@ -252,17 +309,10 @@ public:
       break;
     case Type::FIXED_LEN_BYTE_ARRAY:
     case Type::BYTE_ARRAY:
-      // no dict here we use the result set string heap directly
+      // the dictionary entries point into the page, the strings are
+      // not copied
       {
-        // never going to have more string data than this uncompressed_page_size
-        // (lengths use bytes)
-        auto string_heap_chunk = std::unique_ptr<char[]>(
-            new char[page_header.uncompressed_page_size]);
-        result_col.string_heap_chunks.push_back(std::move(string_heap_chunk));
-        auto str_ptr =
-            result_col
-                .string_heap_chunks[result_col.string_heap_chunks.size() - 1]
-                .get();
+        page_buf_kept = true;
         dict = new Dictionary<pair<uint32_t, char *>>(dict_size);
 
         for (int32_t dict_index = 0; dict_index < dict_size; dict_index++) {
@@ -282,11 +332,7 @@ public:
           }
 
           ((Dictionary<pair<uint32_t, char *>> *)dict)->dict[dict_index] =
-            make_pair(str_len, str_ptr);
-          // TODO make sure we dont run out of str_ptr
-          memcpy(str_ptr, page_buf_ptr, str_len);
-          str_ptr[str_len] = '\0'; // terminate, not really needed any more
-          str_ptr += str_len + 1;
+            make_pair(str_len, (char *) page_buf_ptr);
           page_buf_ptr += str_len;
         }
 
@@ -300,6 +346,47 @@ public:
       throw runtime_error(ss.str());
     }
     }
+
+    filter_dict(result_col);
+  }
+
+  // Evaluate the filter predicates of the column on the dictionary
+  // entries, instead of on every row of the dictionary encoded pages.
+  void filter_dict(ResultColumn &result_col) {
+    if (result_col.preds.empty()) return;
+    const void *values;
+    switch (result_col.col->type) {
+    case Type::INT32:
+      values = ((Dictionary<int32_t> *)dict)->dict.data();
+      break;
+    case Type::INT64:
+      values = ((Dictionary<int64_t> *)dict)->dict.data();
+      break;
+    case Type::FLOAT:
+      values = ((Dictionary<float> *)dict)->dict.data();
+      break;
+    case Type::DOUBLE:
+      values = ((Dictionary<double> *)dict)->dict.data();
+      break;
+    case Type::FIXED_LEN_BYTE_ARRAY:
+    case Type::BYTE_ARRAY:
+      values = ((Dictionary<pair<uint32_t, char *>> *)dict)->dict.data();
+      break;
+    default:
+      // BOOLEAN dictionaries are std::vector<bool>, these are filtered
+      // by value
+      return;
+    }
+    auto &mask = result_col.dict_mask;
+    mask.assign(dict_size, 1);
+    result_col.dict_na_match = true;
+    for (auto pred : result_col.preds) {
+      evaluate_predicate(*pred, values, nullptr, 0, dict_size, mask.data());
+      result_col.dict_na_match =
+        result_col.dict_na_match && predicate_matches_na(*pred);
+    }
+    result_col.dict_none_match = !result_col.dict_na_match &&
+      std::find(mask.begin(), mask.end(), 1) == mask.end();
   }
 
   void scan_data_page(ResultColumn &result_col, bool has_def_levels) {
@@ -317,6 +404,7 @@ public:
       page_header.data_page_header_v2.num_values;
 
     // we have to first decode the define levels, if we have them
+    dict_runs.clear();
     if (has_def_levels) {
       // V2 is always RLE
       if (page_header.__isset.data_page_header &&
@@ -336,17 +424,31 @@ public:
         def_length = page_header.data_page_header_v2.definition_levels_byte_length;
       }
 
-      RleBpDecoder dec((const uint8_t *)page_buf_ptr, def_length, 1);
-      dec.GetBatch<uint8_t>(defined_ptr, num_values);
+      // V2 pages have the number of missing values in the header
+      if (page_header.type == PageType::DATA_PAGE_V2 &&
+          page_header.data_page_header_v2.num_nulls == 0) {
+        bitmap_set(defined, page_start_row, num_values);
+        null_count = 0;
+      } else {
+        RleBpDecoder dec((const uint8_t *)page_buf_ptr, def_length, 1);
+        dec.GetBitmap(defined, page_start_row, num_values);
+        null_count =
+          num_values - bitmap_count(defined, page_start_row, num_values);
+      }
 
       page_buf_ptr += def_length;
     } else {
-      std::fill(defined_ptr, defined_ptr + num_values, static_cast<uint8_t>(1));
+      bitmap_set(defined, page_start_row, num_values);
+      null_count = 0;
     }
 
     Encoding::type encoding = page_header.type == PageType::DATA_PAGE ?
       page_header.data_page_header.encoding :
       page_header.data_page_header_v2.encoding;
+    if (encoding != Encoding::RLE_DICTIONARY &&
+        encoding != Encoding::PLAIN_DICTIONARY) {
+      result_col.has_plain_pages = true;
+    }
     switch (encoding) {
     case Encoding::RLE_DICTIONARY:
     case Encoding::PLAIN_DICTIONARY: // deprecated
@@ -386,42 +488,81 @@ public:
     }
     }
 
-    defined_ptr += num_values;
     page_start_row += num_values;
   }
 
+  // BOOLEAN values are int32_t in a ColumnSink
+  static inline void set_bool(ResultColumn &result_col, uint64_t row_idx,
+                              bool val) {
+    if (result_col.sunk) {
+      ((int32_t *)result_col.out)[row_idx] = val;
+    } else {
+      ((bool *)result_col.out)[row_idx] = val;
+    }
+  }
+
+  // whether row i of the current page is defined
+  inline bool is_defined(uint32_t i) const {
+    return bitmap_get(defined, page_start_row + i);
+  }
+
+  // Calls fn(i, j, n) for each span of defined values of the current
+  // page: rows i, ..., i + n - 1 of the page are defined, and they are
+  // values j, ..., j + n - 1 among the non-missing values. If there
+  // are no missing values, that is a single span. Otherwise we find
+  // the ends of the spans in the definition level bitmap, 64 rows at
+  // a time.
+  template <class F> void for_each_defined_span(uint32_t num_values, F fn) {
+    if (null_count == 0) {
+      if (num_values > 0) fn(0, 0, num_values);
+      return;
+    }
+    uint64_t i = page_start_row, to = page_start_row + num_values;
+    uint32_t j = 0;
+    while (true) {
+      i = bitmap_next(defined, i, to, true);
+      if (i == to) break;
+      uint64_t end = bitmap_next(defined, i, to, false);
+      fn(i - page_start_row, j, end - i);
+      j += end - i;
+      i = end;
+    }
+  }
+
+  // Calls fn(i, j) for each defined value of the current page, see
+  // for_each_defined_span().
+  template <class F> void for_each_defined(uint32_t num_values, F fn) {
+    for_each_defined_span(num_values, [&](uint32_t i, uint32_t j, uint32_t n) {
+      for (uint32_t k = 0; k < n; k++) {
+        fn(i + k, j + k);
+      }
+    });
+  }
+
   template <class T> void fill_values_plain(ResultColumn &result_col) {
-    T *result_arr = (T *)result_col.data.ptr;
+    T *result_arr = (T *)result_col.out + page_start_row;
     auto num_values = page_header.type == PageType::DATA_PAGE ?
       page_header.data_page_header.num_values :
       page_header.data_page_header_v2.num_values;
-    for (int32_t val_offset = 0;
-         val_offset < num_values; val_offset++) {
-
-      if (!defined_ptr[val_offset]) {
-        continue;
-      }
-
-      auto row_idx = page_start_row + val_offset;
-      T val;
-      memcpy(&val, page_buf_ptr, sizeof(val));
-      page_buf_ptr += sizeof(T);
-      result_arr[row_idx] = val;
+    uint64_t len = (uint64_t) (num_values - null_count) * sizeof(T);
+    if (page_buf_ptr + len > page_buf_end_ptr) {
+      std::stringstream ss;
+      ss << "Not enough values in PLAIN data page, invalid Parquet file '"
+         << filename_ << "' @ " << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
     }
+    // a single memcpy for REQUIRED columns, or if there are no missing
+    // values in this page
+    const char *values = page_buf_ptr;
+    for_each_defined_span(num_values, [&](uint32_t i, uint32_t j, uint32_t n) {
+      memcpy(result_arr + i, values + j * sizeof(T), n * sizeof(T));
+    });
+    page_buf_ptr += len;
   }
 
   void scan_data_page_plain(ResultColumn &result_col) {
-    // TODO compute null count while getting the def levels already?
-    // uint32_t null_count = 0;
-    // for (uint32_t i = 0; i < page_header.data_page_header.num_values; i++) {
-    // 	 if (!defined_ptr[i]) {
-    //	 null_count++;
-    //   }
-    // }
-
     switch (result_col.col->type) {
     case Type::BOOLEAN: {
-      bool *result_arr = (bool *)result_col.data.ptr;
       int32_t nv = page_header.type == PageType::DATA_PAGE ?
         page_header.data_page_header.num_values :
         page_header.data_page_header_v2.num_values;
@@ -429,11 +570,11 @@ public:
       int byte_pos = 0;
       for (int32_t idx = 0; idx < nv; idx++) {
         // missing?
-        if (!defined_ptr[idx]) {
+        if (!is_defined(idx)) {
           continue;
         }
-        result_arr[page_start_row + idx] =
-          ((*page_buf_ptr) >> byte_pos) & 1;
+        set_bool(result_col, page_start_row + idx,
+                 ((*page_buf_ptr) >> byte_pos) & 1);
         byte_pos++;
         if (byte_pos == 8) {
           byte_pos = 0;
@@ -465,21 +606,11 @@ public:
         page_header.data_page_header.num_values :
         page_header.data_page_header_v2.num_values;
 
-      uint64_t shc_len = page_header.uncompressed_page_size;
-      if (result_col.col->type == Type::FIXED_LEN_BYTE_ARRAY) {
-        shc_len += num_values; // make space for terminators
-      }
-      auto string_heap_chunk = std::unique_ptr<char[]>(new char[shc_len]);
-      result_col.string_heap_chunks.push_back(std::move(string_heap_chunk));
-      auto str_ptr =
-          result_col
-              .string_heap_chunks[result_col.string_heap_chunks.size() - 1]
-              .get();
-
+      result_col.reserve_str(page_buf_end_ptr - page_buf_ptr);
       for (int32_t val_offset = 0;
            val_offset < num_values; val_offset++) {
 
-        if (!defined_ptr[val_offset]) {
+        if (!is_defined(val_offset)) {
           continue;
         }
 
@@ -496,14 +627,12 @@ public:
              << filename_ << "' @ " << __FILE__ << ":" << __LINE__;
           throw runtime_error(ss.str());
         }
+        if (wanted && !wanted[row_idx]) {
+          page_buf_ptr += str_len;
+          continue;
+        }
 
-        ((pair<uint32_t, char *>*)result_col.data.ptr)[row_idx] =
-          make_pair(str_len, str_ptr);
-        // TODO make sure we dont run out of str_ptr too
-        memcpy(str_ptr, page_buf_ptr, str_len);
-        str_ptr[str_len] = '\0';
-        str_ptr += str_len + 1;
-
+        memcpy(result_col.add_str(row_idx, str_len), page_buf_ptr, str_len);
         page_buf_ptr += str_len;
       }
     } break;
@@ -520,20 +649,29 @@ public:
 
   template <class T>
   void fill_values_dict(ResultColumn &result_col, uint32_t *offsets) {
-    auto result_arr = (T *)result_col.data.ptr;
+    auto result_arr = (T *)result_col.out + page_start_row;
     auto num_values = page_header.type == PageType::DATA_PAGE ?
       page_header.data_page_header.num_values :
       page_header.data_page_header_v2.num_values;
-    for (int32_t val_offset = 0;
-         val_offset < num_values; val_offset++) {
-      // always unpack because NULLs area also encoded (?)
-      auto row_idx = page_start_row + val_offset;
-
-      if (defined_ptr[val_offset]) {
-        auto offset = offsets[val_offset];
-        result_arr[row_idx] = ((Dictionary<T> *)dict)->get(offset);
+    Dictionary<T> *d = (Dictionary<T> *)dict;
+    if (null_count == 0) {
+      // look up repeated indices once
+      uint32_t i = 0;
+      for (auto &run : dict_runs) {
+        for (; i < run.from; i++) {
+          result_arr[i] = d->get(offsets[i]);
+        }
+        std::fill(result_arr + i, result_arr + i + run.len, d->get(offsets[i]));
+        i += run.len;
+      }
+      for (; i < num_values; i++) {
+        result_arr[i] = d->get(offsets[i]);
       }
+      return;
     }
+    for_each_defined(num_values, [&](uint32_t i, uint32_t j) {
+      result_arr[i] = d->get(offsets[i]);
+    });
   }
 
   // here we look back into the dicts and emit the values we find if the value
@@ -560,23 +698,29 @@ public:
     if (enc_length > 0) {
       RleBpDecoder dec((const uint8_t *)page_buf_ptr, page_buf_len, enc_length);
 
-      uint32_t null_count = 0;
-      for (uint32_t i = 0; i < num_values; i++) {
-        if (!defined_ptr[i]) {
-          null_count++;
-        }
-      }
       if (null_count > 0) {
-        dec.GetBatchSpaced<uint32_t>(num_values, null_count, defined_ptr,
-                                     offsets.get());
+        dec.GetBatchSpaced<uint32_t>(num_values, null_count, defined,
+                                     page_start_row, offsets.get());
       } else {
-        dec.GetBatch<uint32_t>(offsets.get(), num_values);
+        dec.GetBatch<uint32_t>(offsets.get(), num_values, &dict_runs);
       }
 
     } else {
       memset(offsets.get(), 0, num_values * sizeof(uint32_t));
     }
 
+    // keep the offsets for filtering in dictionary space, or for the
+    // caller
+    if (!result_col.dict_mask.empty() || result_col.keep_dict_offsets) {
+      memcpy(
+        (uint32_t *) result_col.dict_offsets.ptr + page_start_row,
+        offsets.get(),
+        num_values * sizeof(uint32_t)
+      );
+      add_row_range(result_col.dict_rows, page_start_row,
+                    page_start_row + num_values);
+    }
+
     switch (result_col.col->type) {
     case Type::INT32:
       fill_values_dict<int32_t>(result_col, offsets.get());
@@ -604,19 +748,22 @@ public:
 
     case Type::FIXED_LEN_BYTE_ARRAY:
     case Type::BYTE_ARRAY: {
-      auto result_arr = (pair<uint32_t, char *>*)result_col.data.ptr;
       auto num_values = page_header.type == PageType::DATA_PAGE ?
         page_header.data_page_header.num_values :
         page_header.data_page_header_v2.num_values;
-      for (int32_t val_offset = 0;
-           val_offset < num_values; val_offset++) {
-        if (defined_ptr[val_offset]) {
-          result_arr[page_start_row + val_offset] =
-              ((Dictionary<pair<uint32_t, char *>> *)dict)->get(offsets[val_offset]);
-        } else {
-          result_arr[page_start_row + val_offset] = make_pair(0, nullptr);
-        }
+      auto sdict = (Dictionary<pair<uint32_t, char *>> *)dict;
+      // the caller looks these rows up in the dictionary
+      if (result_col.keep_dict_offsets) {
+        for_each_defined(num_values, [&](uint32_t i, uint32_t j) {
+          sdict->get(offsets[i]); // check bounds
+        });
+        break;
       }
+      for_each_defined(num_values, [&](uint32_t i, uint32_t j) {
+        auto &val = sdict->get(offsets[i]);
+        memcpy(result_col.add_str(page_start_row + i, val.first),
+               val.second, val.first);
+      });
       break;
     }
     default: {
@@ -637,31 +784,21 @@ public:
     auto enc_length = 1;
     RleBpDecoder dec((const uint8_t *) page_buf_ptr, page_buf_len, enc_length);
     auto offsets = unique_ptr<bool[]>(new bool[num_values]);
-    uint32_t null_count = 0;
-    for (uint32_t i = 0; i < num_values; i++) {
-      if (!defined_ptr[i]) {
-        null_count++;
-      }
-    }
     if (null_count > 0) {
-      dec.GetBatchSpaced<bool>(num_values, null_count, defined_ptr,
-                                   offsets.get());
+      dec.GetBatchSpaced<bool>(num_values, null_count, defined,
+                               page_start_row, offsets.get());
     } else {
       dec.GetBatch<bool>(offsets.get(), num_values);
     }
 
-    bool *result_arr = (bool*) result_col.data.ptr;
-    for (uint32_t val_offset = 0;
-        val_offset < num_values;
-        val_offset++) {
-      auto row_idx = page_start_row + val_offset;
-      if (defined_ptr[val_offset]) {
-        result_arr[row_idx] = offsets[val_offset];
-      }
-    }
+    for_each_defined(num_values, [&](uint32_t i, uint32_t j) {
+      set_bool(result_col, page_start_row + i, offsets[i]);
+    });
   }
 
-  void scan_data_page_delta_binary_packed(ResultColumn &result_col) {
+  template <class T, class Tunsigned>
+  void fill_values_dbp(ResultColumn &result_col) {
+    T *result_arr = (T *) result_col.out;
     auto num_values = page_header.type == PageType::DATA_PAGE ?
       page_header.data_page_header.num_values :
       page_header.data_page_header_v2.num_values;
@@ -669,38 +806,36 @@ public:
       (uint8_t*) page_buf_ptr,
       (uint32_t) page_header.uncompressed_page_size
     };
+    DbpDecoder<T, Tunsigned> dec(&buf);
+    uint32_t num_non_null = num_values - null_count;
+    if (dec.size() != num_non_null) {
+      throw runtime_error(
+        "Wrong number of values in DELTA_BINARY_PACKED data page"
+      );
+    }
+
+    // without missing values we decode right into the result, otherwise
+    // into a buffer first
+    if (null_count == 0) {
+      dec.decode(result_arr + page_start_row);
+    } else {
+      unique_ptr<T[]> vals(new T[num_non_null]);
+      dec.decode(vals.get());
+      for_each_defined_span(num_values, [&](uint32_t i, uint32_t j, uint32_t n) {
+        memcpy(result_arr + page_start_row + i, vals.get() + j, n * sizeof(T));
+      });
+    }
     page_buf_ptr += page_header.compressed_page_size;
+  }
+
+  void scan_data_page_delta_binary_packed(ResultColumn &result_col) {
     switch (result_col.col->type) {
-    case Type::INT32: {
-      int32_t *result_arr = (int32_t *)result_col.data.ptr;
-      DbpDecoder<int32_t, uint32_t> dec(&buf);
-      uint32_t num_non_null_values = dec.size();
-      unique_ptr<int32_t[]> vals(new int32_t[num_non_null_values]);
-      dec.decode(vals.get());
-      for (uint32_t i = 0, j = 0; i < num_values; i++) {
-        if (!defined_ptr[i]) {
-          continue;
-        }
-        auto row_idx = page_start_row + i;
-        result_arr[row_idx] = vals[j++];
-      }
+    case Type::INT32:
+      fill_values_dbp<int32_t, uint32_t>(result_col);
       break;
-    }
-    case Type::INT64: {
-      int64_t *result_arr = (int64_t *)result_col.data.ptr;
-      DbpDecoder<int64_t, uint64_t> dec(&buf);
-      uint32_t num_non_null_values = dec.size();
-      unique_ptr<int64_t[]> vals(new int64_t[num_non_null_values]);
-      dec.decode(vals.get());
-      for (uint32_t i = 0, j = 0; i < num_values; i++) {
-        if (!defined_ptr[i]) {
-          continue;
-        }
-        auto row_idx = page_start_row + i;
-        result_arr[row_idx] = vals[j++];
-      }
+    case Type::INT64:
+      fill_values_dbp<int64_t, uint64_t>(result_col);
       break;
-    }
     default: {
       throw runtime_error("DELTA_BINARY_PACKED encoding must be INT32 or INT64");
       break;
@@ -725,15 +860,10 @@ public:
     uint32_t num_non_null_values = dec.size();
     unique_ptr<int32_t[]> lengths(new int32_t[num_non_null_values]);
     uint8_t *bts = dec.decode(lengths.get());
-    uint64_t shc_len = page_header.uncompressed_page_size + num_values;
-    auto string_heap_chunk = std::unique_ptr<char[]>(new char[shc_len]);
-    result_col.string_heap_chunks.push_back(std::move(string_heap_chunk));
-    auto str_ptr = result_col
-      .string_heap_chunks[result_col.string_heap_chunks.size() - 1]
-      .get();
+    result_col.reserve_str((uint8_t *) page_buf_end_ptr - bts);
 
     for (uint32_t i = 0, j = 0; i < num_values; i++) {
-      if (!defined_ptr[i]) {
+      if (!is_defined(i)) {
         continue;
       }
       auto row_idx = page_start_row + i;
@@ -744,11 +874,11 @@ public:
            << filename_ << "' @ " << __FILE__ << ":" << __LINE__;
         throw runtime_error(ss.str());
       }
-      ((pair<uint32_t, char *>*)result_col.data.ptr)[row_idx] =
-        make_pair(str_len, str_ptr);
-      memcpy(str_ptr, bts, str_len);
-      str_ptr[str_len] = '\0';
-      str_ptr += str_len + 1;
+      if (wanted && !wanted[row_idx]) {
+        bts += str_len;
+        continue;
+      }
+      memcpy(result_col.add_str(row_idx, str_len), bts, str_len);
       bts += str_len;
     }
     page_buf_ptr += page_header.compressed_page_size;
@@ -777,25 +907,30 @@ public:
     DbpDecoder<int32_t, uint32_t> sufdec(&buf);
     uint8_t *bts = sufdec.decode(suf_lengths.get());
 
-    uint64_t shc_len = num_non_null_values; // for trailing zeros
-    for (auto i = 0; i < num_non_null_values; i++) shc_len += pre_lengths[i];
-    for (auto i = 0; i < num_non_null_values; i++) shc_len += suf_lengths[i];
-    auto string_heap_chunk = std::unique_ptr<char[]>(new char[shc_len]);
-    result_col.string_heap_chunks.push_back(std::move(string_heap_chunk));
-    auto str_ptr = result_col
-      .string_heap_chunks[result_col.string_heap_chunks.size() - 1]
-      .get();
+    uint64_t total_len = 0;
+    for (auto i = 0; i < num_non_null_values; i++) {
+      if (pre_lengths[i] < 0 || suf_lengths[i] < 0) {
+        throw runtime_error("Invalid DELTA_BYTE_ARRAY encoding, negative length");
+      }
+      total_len += pre_lengths[i] + suf_lengths[i];
+    }
+    result_col.reserve_str(total_len);
 
-    char *prev_str_ptr = nullptr;
+    // the prefix comes from the previous value, which is in the result
+    int64_t prev_off = -1;
+    int32_t prev_len = 0;
     for (uint32_t i = 0, j = 0; i < num_values; i++) {
-      if (!defined_ptr[i]) {
+      if (!is_defined(i)) {
         continue;
       }
       auto row_idx = page_start_row + i;
       auto pre_len = pre_lengths[j];
-      if (pre_len > 0 && prev_str_ptr == nullptr) {
+      if (pre_len > 0 && prev_off < 0) {
         throw runtime_error("Invalid DELTA_BYTE_ARRAY encoding, first prefix must be zero");
       }
+      if (pre_len > prev_len) {
+        throw runtime_error("Invalid DELTA_BYTE_ARRAY encoding, prefix is longer than the previous value");
+      }
       auto suf_len = suf_lengths[j];
       j++;
       auto str_len = pre_len + suf_len;
@@ -805,45 +940,43 @@ public:
            << filename_ << "' @ " << __FILE__ << ":" << __LINE__;
         throw runtime_error(ss.str());
       }
-      ((pair<uint32_t, char *>*)result_col.data.ptr)[row_idx] =
-        make_pair(str_len, str_ptr);
+      char *str_ptr = result_col.add_str(row_idx, str_len);
       if (pre_len > 0) {
-        memcpy(str_ptr, prev_str_ptr, pre_len);
+        memcpy(str_ptr, result_col.strings.ptr + prev_off, pre_len);
       }
       if (suf_len > 0) {
         memcpy(str_ptr + pre_len, bts, suf_len);
         bts += suf_len;
       }
-      str_ptr[str_len] = '\0';
-      prev_str_ptr = str_ptr;
-      str_ptr += str_len + 1;
+      prev_off = str_ptr - result_col.strings.ptr;
+      prev_len = str_len;
     }
     page_buf_ptr += page_header.compressed_page_size;
   }
 
   template <class T> void fill_values_bss(ResultColumn &result_col) {
-    T *result_arr = (T *) result_col.data.ptr;
+    T *result_arr = (T *) result_col.out;
     auto num_values = page_header.type == PageType::DATA_PAGE ?
       page_header.data_page_header.num_values :
       page_header.data_page_header_v2.num_values;
-    uint32_t num_non_null = 0;
-    for (uint32_t i = 0; i < num_values; i++) {
-      if (defined_ptr[i]) num_non_null++;
+    uint32_t num_non_null = num_values - null_count;
+    if (page_buf_ptr + (uint64_t) num_non_null * sizeof(T) > page_buf_end_ptr) {
+      throw runtime_error("Not enough bytes in BYTE_STREAM_SPLIT data page");
     }
 
-    for (int32_t i = 0, j = 0; i < num_values; i++) {
-      if (!defined_ptr[i]) {
-        continue;
-      }
-
-      auto row_idx = page_start_row + i;
-      T val;
-      uint8_t *bts = (uint8_t *) &val;
-      for (int b = 0; b < sizeof(T); b++) {
-        bts[b] = page_buf_ptr[b * num_non_null + j];
-      }
-      result_arr[row_idx] = val;
-      j++;
+    // without missing values we decode right into the result, otherwise
+    // into a buffer first
+    const uint8_t *in = (const uint8_t *) page_buf_ptr;
+    if (null_count == 0) {
+      bss_decode<sizeof(T)>(in, num_non_null, num_non_null,
+                            (uint8_t *) (result_arr + page_start_row));
+    } else {
+      unique_ptr<T[]> vals(new T[num_non_null]);
+      bss_decode<sizeof(T)>(in, num_non_null, num_non_null,
+                            (uint8_t *) vals.get());
+      for_each_defined_span(num_values, [&](uint32_t i, uint32_t j, uint32_t n) {
+        memcpy(result_arr + page_start_row + i, vals.get() + j, n * sizeof(T));
+      });
     }
     page_buf_ptr += page_header.compressed_page_size;
   }
@@ -866,37 +999,28 @@ public:
       auto num_values = page_header.type == PageType::DATA_PAGE ?
         page_header.data_page_header.num_values :
         page_header.data_page_header_v2.num_values;
-      uint64_t shc_len = page_header.uncompressed_page_size + num_values;
-      auto string_heap_chunk = std::unique_ptr<char[]>(new char[shc_len]);
-      result_col.string_heap_chunks.push_back(std::move(string_heap_chunk));
-      auto str_ptr = result_col
-        .string_heap_chunks[result_col.string_heap_chunks.size() - 1]
-        .get();
-
       if (page_buf_ptr + num_values * type_len > page_buf_end_ptr) {
         throw runtime_error("Not enough bytes in BYTE_STREAM_SPLIT data page");
       }
 
-      uint32_t num_non_null = 0;
-      for (uint32_t i = 0; i < num_values; i++) {
-        if (defined_ptr[i]) num_non_null++;
-      }
-
-      for (uint32_t i = 0, j = 0; i < num_values; i++) {
-        if (!defined_ptr[i]) {
-          continue;
-        }
-
-        auto row_idx = page_start_row + i;
-
-        ((pair<uint32_t, char *>*)result_col.data.ptr)[row_idx] =
-          make_pair(type_len, str_ptr);
-        for (uint32_t b = 0; b < type_len; b++) {
-          str_ptr[b] = page_buf_ptr[b * num_non_null + j];
+      uint32_t num_non_null = num_values - null_count;
+
+      // the values of the page are contiguous in the result, value j
+      // goes to str_ptr + j * type_len
+      result_col.reserve_str((uint64_t) num_non_null * type_len);
+      char *str_ptr = nullptr;
+      for_each_defined(num_values, [&](uint32_t i, uint32_t j) {
+        char *val = result_col.add_str(page_start_row + i, type_len);
+        if (j == 0) str_ptr = val;
+      });
+
+      // we fill these one byte stream at a time
+      for (uint32_t b = 0; str_ptr && b < type_len; b++) {
+        const char *src = page_buf_ptr + (uint64_t) b * num_non_null;
+        char *dst = str_ptr + b;
+        for (uint32_t j = 0; j < num_non_null; j++) {
+          dst[(uint64_t) j * type_len] = src[j];
         }
-        str_ptr[type_len] = '\0';
-        str_ptr += type_len + 1;
-        j++;
       }
       page_buf_ptr += page_header.compressed_page_size;
       break;
@@ -942,15 +1066,9 @@ public:
   }
 };
 
-void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
-  // we now expect a sequence of data pages in the buffer
-
-  auto &row_group = file_meta_data.row_groups[state.row_group_idx];
-  auto &chunk = row_group.columns[result_col.id];
-
-  //	chunk.printTo(cerr);
-  //	cerr << "\n";
-
+void ParquetFile::column_chunk_range(const ColumnChunk &chunk,
+                                     int64_t &chunk_start,
+                                     int64_t &chunk_len) {
   if (chunk.__isset.file_path) {
     std::stringstream ss;
     ss << "Only inlined Parquet files are supported (no references). "
@@ -968,26 +1086,354 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
   }
 
   // ugh. sometimes there is an extra offset for the dict. sometimes it's wrong.
-  auto chunk_start = chunk.meta_data.data_page_offset;
+  chunk_start = chunk.meta_data.data_page_offset;
   if (chunk.meta_data.__isset.dictionary_page_offset &&
       chunk.meta_data.dictionary_page_offset >= 4) {
     // this assumes the data pages follow the dict pages directly.
     chunk_start = chunk.meta_data.dictionary_page_offset;
   }
-  auto chunk_len = chunk.meta_data.total_compressed_size;
-
-  // read entire chunk into RAM
-  pfile.seekg(chunk_start);
-  ByteBuffer chunk_buf;
-  chunk_buf.resize(chunk_len);
+  chunk_len = chunk.meta_data.total_compressed_size;
 
-  pfile.read(chunk_buf.ptr, chunk_len);
-  if (!pfile) {
+  if (chunk_start < 0 || chunk_len < 0 ||
+      (uint64_t) chunk_start + chunk_len > file_size) {
     std::stringstream ss;
     ss << "Could not read Parquet column chunk. Possibly currupt file '"
        << filename << "' @ " << __FILE__ << ":" << __LINE__;
     throw runtime_error(ss.str());
   }
+}
+
+// Read planner. Instead of one seek + read per column chunk, we sort
+// the byte ranges of the column chunks we need, merge the ones that are
+// adjacent, or closer than read_gap bytes, and read each merged range
+// with a single read. The bytes in the gaps are read and thrown away.
+// With memory mapping there is nothing to read, we just point into the
+// mapping, and ask the OS to read the chunks ahead. If the page index
+// let us skip pages, then we plan the reads of the page runs we need,
+// instead of the whole column chunks.
+
+void ParquetFile::read_row_group(const RowGroupRange &rg_range,
+                                 const std::vector<uint64_t> &col_ids,
+                                 RowGroupData &data) {
+  auto &row_group = file_meta_data.row_groups[rg_range.row_group];
+  auto ncols = col_ids.size();
+  data.row_group = rg_range.row_group;
+  data.chunks.assign(ncols, nullptr);
+  data.buffers.clear();
+  data.use_pages.assign(ncols, 0);
+  data.pages.assign(ncols, std::vector<PageRun>());
+  data.paged = !filter.empty() && select_pages(rg_range, col_ids, data);
+
+  struct range {
+    int64_t start;
+    int64_t len;
+    size_t col;
+    // index into data.pages[col], or -1 for the whole chunk
+    int64_t run;
+  };
+  std::vector<range> ranges;
+  for (size_t i = 0; i < ncols; i++) {
+    if (data.use_pages[i]) {
+      for (size_t r = 0; r < data.pages[i].size(); r++) {
+        auto &run = data.pages[i][r];
+        ranges.push_back({ run.offset, run.len, i, (int64_t) r });
+      }
+    } else {
+      auto &chunk = row_group.columns[col_ids[i]];
+      range r = { 0, 0, i, -1 };
+      column_chunk_range(chunk, r.start, r.len);
+      ranges.push_back(r);
+    }
+  }
+  auto set_ptr = [&](const range &r, const char *ptr) {
+    if (r.run < 0) {
+      data.chunks[r.col] = ptr;
+    } else {
+      data.pages[r.col][r.run].ptr = ptr;
+    }
+  };
+
+  std::unique_lock<std::mutex> lock(io_mutex);
+  read_stats.num_chunks += ncols;
+  // positional reads do not need the lock, only the stream does
+  if (rafile.is_open()) {
+    lock.unlock();
+  }
+
+  if (mmap_file.is_open()) {
+    for (auto &r : ranges) {
+      set_ptr(r, mmap_file.data() + r.start);
+      mmap_file.will_need(r.start, r.len);
+    }
+    return;
+  }
+
+  std::sort(ranges.begin(), ranges.end(), [](const range &a, const range &b) {
+    return a.start < b.start;
+  });
+
+  size_t first = 0;
+  size_t nranges = ranges.size();
+  while (first < nranges) {
+    int64_t start = ranges[first].start;
+    int64_t end = start + ranges[first].len;
+    size_t last = first + 1;
+    while (last < nranges &&
+           ranges[last].start <= end + (int64_t) read_gap) {
+      end = std::max(end, ranges[last].start + ranges[last].len);
+      last++;
+    }
+
+    std::unique_ptr<char[]> buf(new char[end - start]);
+    bool ok;
+    if (rafile.is_open()) {
+      ok = rafile.read_at(start, end - start, buf.get());
+    } else {
+      pfile.seekg(start, ios_base::beg);
+      pfile.read(buf.get(), end - start);
+      ok = !!pfile;
+    }
+    if (!ok) {
+      std::stringstream ss;
+      ss << "Could not read Parquet column chunk. Possibly currupt file '"
+         << filename << "' @ " << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
+    }
+    for (size_t i = first; i < last; i++) {
+      set_ptr(ranges[i], buf.get() + (ranges[i].start - start));
+    }
+    data.buffers.push_back(std::move(buf));
+    {
+      std::unique_lock<std::mutex> stats_lock(io_mutex, std::defer_lock);
+      if (!lock.owns_lock()) stats_lock.lock();
+      read_stats.num_reads++;
+      read_stats.bytes_read += end - start;
+    }
+    first = last;
+  }
+}
+
+// Read len bytes at offset. With memory mapping this returns a pointer
+// into the mapping, otherwise the bytes are read into buf. Must be
+// called without holding io_mutex.
+
+const char *ParquetFile::read_bytes(int64_t offset, int64_t len,
+                                    std::unique_ptr<char[]> &buf) {
+  if (offset < 0 || len < 0 || (uint64_t) offset + len > file_size) {
+    std::stringstream ss;
+    ss << "Unexpected end of Parquet file, possibly corrupt file '"
+       << filename << "' @ " << __FILE__ << ":" << __LINE__;
+    throw runtime_error(ss.str());
+  }
+  if (mmap_file.is_open()) {
+    return mmap_file.data() + offset;
+  }
+  buf.reset(new char[len]);
+  bool ok;
+  std::unique_lock<std::mutex> lock(io_mutex);
+  if (rafile.is_open()) {
+    lock.unlock();
+    ok = rafile.read_at(offset, len, buf.get());
+    lock.lock();
+  } else {
+    pfile.seekg(offset, ios_base::beg);
+    pfile.read(buf.get(), len);
+    ok = !!pfile;
+  }
+  if (!ok) {
+    std::stringstream ss;
+    ss << "Could not read from Parquet file. Possibly currupt file '"
+       << filename << "' @ " << __FILE__ << ":" << __LINE__;
+    throw runtime_error(ss.str());
+  }
+  read_stats.num_reads++;
+  read_stats.bytes_read += len;
+  return buf.get();
+}
+
+static vector<RowRange> intersect_ranges(const vector<RowRange> &a,
+                                         const vector<RowRange> &b) {
+  vector<RowRange> res;
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    uint64_t from = std::max(a[i].from, b[j].from);
+    uint64_t to = std::min(a[i].to, b[j].to);
+    if (from < to) res.push_back({ from, to });
+    if (a[i].to < b[j].to) i++; else j++;
+  }
+  return res;
+}
+
+// Page level filtering with the page index. For every filter column
+// that has a ColumnIndex and an OffsetIndex, we check the min/max
+// values and null counts of its pages against the predicate, and keep
+// the row ranges of the pages that may match. Then for every column
+// that has an OffsetIndex we only read and decode the pages that have
+// rows in these ranges (plus the dictionary page). Returns false if we
+// cannot use the page index for this row group.
+
+bool ParquetFile::select_pages(const RowGroupRange &rg_range,
+                               const std::vector<uint64_t> &col_ids,
+                               RowGroupData &data) {
+  auto &row_group = file_meta_data.row_groups[rg_range.row_group];
+  uint64_t rg_nrows = row_group.num_rows;
+
+  // the offset indices we have read already, by column
+  std::map<uint64_t, OffsetIndex> offset_indices;
+  auto read_offset_index = [&](uint64_t col, OffsetIndex &oi) {
+    auto it = offset_indices.find(col);
+    if (it != offset_indices.end()) {
+      oi = it->second;
+      return !oi.page_locations.empty();
+    }
+    auto &chunk = row_group.columns[col];
+    if (!chunk.__isset.offset_index_offset ||
+        !chunk.__isset.offset_index_length) {
+      return false;
+    }
+    std::unique_ptr<char[]> buf;
+    const char *ptr = read_bytes(chunk.offset_index_offset,
+                                 chunk.offset_index_length, buf);
+    uint32_t len = chunk.offset_index_length;
+    thrift_unpack((const uint8_t *) ptr, &len, &oi, filename);
+    // must be sorted and within the row group, otherwise we ignore it
+    auto &locs = oi.page_locations;
+    for (size_t p = 0; p < locs.size(); p++) {
+      if (locs[p].first_row_index < 0 ||
+          (uint64_t) locs[p].first_row_index > rg_nrows ||
+          locs[p].compressed_page_size <= 0 ||
+          (p > 0 && locs[p].first_row_index < locs[p - 1].first_row_index) ||
+          (p > 0 && locs[p].offset < locs[p - 1].offset)) {
+        locs.clear();
+        break;
+      }
+    }
+    offset_indices[col] = oi;
+    return !locs.empty();
+  };
+  auto page_end_row = [&](const OffsetIndex &oi, size_t p) {
+    auto &locs = oi.page_locations;
+    return p + 1 < locs.size() ? (uint64_t) locs[p + 1].first_row_index :
+      rg_nrows;
+  };
+
+  std::vector<RowRange> rows = { { rg_range.from, rg_range.to } };
+  bool used = false;
+  for (auto &pred : filter) {
+    auto &chunk = row_group.columns[pred.column];
+    if (!chunk.__isset.column_index_offset ||
+        !chunk.__isset.column_index_length) {
+      continue;
+    }
+    OffsetIndex oi;
+    if (!read_offset_index(pred.column, oi)) continue;
+    ColumnIndex ci;
+    std::unique_ptr<char[]> buf;
+    const char *ptr = read_bytes(chunk.column_index_offset,
+                                 chunk.column_index_length, buf);
+    uint32_t len = chunk.column_index_length;
+    thrift_unpack((const uint8_t *) ptr, &len, &ci, filename);
+    size_t npages = oi.page_locations.size();
+    if (ci.null_pages.size() != npages || ci.min_values.size() != npages ||
+        ci.max_values.size() != npages) {
+      continue;
+    }
+    bool has_null_counts =
+      ci.__isset.null_counts && ci.null_counts.size() == npages;
+
+    std::vector<RowRange> match;
+    for (size_t p = 0; p < npages; p++) {
+      uint64_t from = oi.page_locations[p].first_row_index;
+      uint64_t to = page_end_row(oi, p);
+      ValueStats st;
+      st.num_values = to - from;
+      if (ci.null_pages[p]) {
+        st.has_null_count = true;
+        st.null_count = st.num_values;
+      } else {
+        st.has_min_max = true;
+        st.min = ci.min_values[p];
+        st.max = ci.max_values[p];
+        if (has_null_counts) {
+          st.has_null_count = true;
+          st.null_count = ci.null_counts[p];
+        }
+      }
+      if (!stats_may_match(pred, st)) continue;
+      if (!match.empty() && match.back().to == from) {
+        match.back().to = to;
+      } else {
+        match.push_back({ from, to });
+      }
+    }
+    rows = intersect_ranges(rows, match);
+    used = true;
+  }
+  if (!used) return false;
+  data.row_ranges = rows;
+
+  uint64_t pruned = 0;
+  for (size_t i = 0; i < col_ids.size(); i++) {
+    auto &chunk = row_group.columns[col_ids[i]];
+    OffsetIndex oi;
+    if (!read_offset_index(col_ids[i], oi)) continue;
+    int64_t chunk_start, chunk_len;
+    column_chunk_range(chunk, chunk_start, chunk_len);
+    auto &locs = oi.page_locations;
+    if (locs.front().offset < chunk_start ||
+        locs.back().offset + locs.back().compressed_page_size >
+          chunk_start + chunk_len) {
+      continue;
+    }
+    auto &pages = data.pages[i];
+    // dictionary page, it is before the first data page
+    if (locs.front().offset > chunk_start) {
+      pages.push_back({ chunk_start, locs.front().offset - chunk_start, -1,
+                        nullptr });
+    }
+    size_t r = 0;
+    bool prev_selected = false;
+    for (size_t p = 0; p < locs.size(); p++) {
+      uint64_t from = locs[p].first_row_index;
+      uint64_t to = page_end_row(oi, p);
+      while (r < rows.size() && rows[r].to <= from) r++;
+      if (r == rows.size() || rows[r].from >= to) {
+        prev_selected = false;
+        pruned++;
+        continue;
+      }
+      // extend the current run, if this page follows it directly
+      if (prev_selected &&
+          pages.back().offset + pages.back().len == locs[p].offset) {
+        pages.back().len += locs[p].compressed_page_size;
+      } else {
+        pages.push_back({ locs[p].offset, locs[p].compressed_page_size,
+                          (int64_t) from, nullptr });
+      }
+      prev_selected = true;
+    }
+    data.use_pages[i] = 1;
+  }
+
+  std::lock_guard<std::mutex> lock(io_mutex);
+  read_stats.pages_pruned += pruned;
+  return true;
+}
+
+void ParquetFile::scan_column(uint64_t row_group_idx,
+                              ResultColumn &result_col,
+                              const char *chunk_ptr,
+                              const std::vector<PageRun> *pages,
+                              const uint8_t *wanted,
+                              uint64_t row_from, uint64_t row_to) {
+  // we now expect a sequence of data pages in the buffer
+
+  auto &row_group = file_meta_data.row_groups[row_group_idx];
+  auto &chunk = row_group.columns[result_col.id];
+  auto chunk_len = chunk.meta_data.total_compressed_size;
+
+  //	chunk.printTo(cerr);
+  //	cerr << "\n";
 
   // now we have whole chunk in buffer, proceed to read pages
   ColumnScan cs(filename);
@@ -999,24 +1445,42 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
   }
 
   cs.page_start_row = 0;
-  cs.defined_ptr = (uint8_t *)result_col.defined.ptr;
+  cs.defined = (uint64_t *)result_col.defined.ptr;
+  cs.wanted = wanted;
   SchemaElement sch = file_meta_data.schema[result_col.id + 1]; // skip root
   bool has_def_levels = sch.repetition_type != FieldRepetitionType::REQUIRED;
 
-  while (bytes_to_read > 0) {
+  // with a page selection we go over the page runs instead of the chunk
+  size_t run_idx = 0;
+  if (pages) {
+    bytes_to_read = 0;
+  }
+  uint64_t pages_decoded = 0, pages_skipped = 0;
+
+  while (true) {
+    if (bytes_to_read <= 0) {
+      if (!pages || run_idx >= pages->size()) break;
+      auto &run = (*pages)[run_idx++];
+      chunk_ptr = run.ptr;
+      bytes_to_read = run.len;
+      if (run.first_row >= 0) {
+        cs.page_start_row = run.first_row;
+      }
+      continue;
+    }
     auto page_header_len = bytes_to_read; // the header is clearly not that long
                                           // but we have no idea
 
     // this is the only other place where we actually unpack a thrift object
     cs.page_header = PageHeader();
-    thrift_unpack((const uint8_t *)chunk_buf.ptr, (uint32_t *)&page_header_len,
+    thrift_unpack((const uint8_t *)chunk_ptr, (uint32_t *)&page_header_len,
                   &cs.page_header, filename);
     //
     //		cs.page_header.printTo(cerr);
     //		cerr << "\n";
 
     // compressed_page_size does not include the header size
-    chunk_buf.ptr += page_header_len;
+    chunk_ptr += page_header_len;
     bytes_to_read -= page_header_len;
 
     // skip data page v2 repetition levels if we don't need them
@@ -1026,9 +1490,48 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
       xrep = cs.page_header.data_page_header_v2.repetition_levels_byte_length;
     }
 
-    auto payload_end_ptr = chunk_buf.ptr + cs.page_header.compressed_page_size;
+    auto payload_end_ptr = chunk_ptr + cs.page_header.compressed_page_size;
+
+    // Skip data pages outside of the requested rows, without decompressing
+    // them. We can do this because for flat tables num_values is the
+    // number of rows in the page.
+    if (cs.page_header.type == PageType::DATA_PAGE ||
+        cs.page_header.type == PageType::DATA_PAGE_V2) {
+      uint64_t num_values = cs.page_header.type == PageType::DATA_PAGE ?
+        cs.page_header.data_page_header.num_values :
+        cs.page_header.data_page_header_v2.num_values;
+      if (cs.page_start_row >= row_to) {
+        break;
+      }
+      Encoding::type encoding = cs.page_header.type == PageType::DATA_PAGE ?
+        cs.page_header.data_page_header.encoding :
+        cs.page_header.data_page_header_v2.encoding;
+      // no row of this page can satisfy the filter, we don't need
+      // to decode it
+      bool no_match = result_col.dict_none_match &&
+        (encoding == Encoding::RLE_DICTIONARY ||
+         encoding == Encoding::PLAIN_DICTIONARY);
+      if (no_match) {
+        add_row_range(result_col.dict_rows, cs.page_start_row,
+                      cs.page_start_row + num_values);
+      }
+      // with a filter, only pages with selected rows are needed
+      if (wanted && !no_match && cs.page_start_row < (uint64_t) row_group.num_rows) {
+        uint64_t end = std::min(cs.page_start_row + num_values,
+                                (uint64_t) row_group.num_rows);
+        no_match = std::find(wanted + cs.page_start_row, wanted + end, 1) ==
+          wanted + end;
+      }
+      if (cs.page_start_row + num_values <= row_from || no_match) {
+        if (no_match) pages_skipped++;
+        cs.page_start_row += num_values;
+        chunk_ptr = payload_end_ptr;
+        bytes_to_read -= cs.page_header.compressed_page_size;
+        continue;
+      }
+    }
 
-    ByteBuffer decompressed_buf;
+    std::unique_ptr<char[]> decompressed_buf;
     CompressionCodec::type codec = chunk.meta_data.codec;
     if (cs.page_header.__isset.data_page_header_v2 &&
         cs.page_header.data_page_header_v2.__isset.is_compressed &&
@@ -1048,21 +1551,22 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
 
     switch (codec) {
     case CompressionCodec::UNCOMPRESSED:
-      cs.page_buf_ptr = chunk_buf.ptr;
+      // decode in place, this is in the mapping if the file is mapped
+      cs.page_buf_ptr = chunk_ptr;
       cs.page_buf_len = cs.page_header.compressed_page_size;
 
       break;
     case CompressionCodec::SNAPPY: {
       size_t decompressed_size;
-      snappy::GetUncompressedLength(chunk_buf.ptr + xrep + xdef,
+      snappy::GetUncompressedLength(chunk_ptr + xrep + xdef,
                                     cs.page_header.compressed_page_size - xrep - xdef,
                                     &decompressed_size);
-      decompressed_buf.resize(decompressed_size + 1 + xdef);
-      memcpy(decompressed_buf.ptr, chunk_buf.ptr + xrep, xdef);
+      decompressed_buf.reset(new char[decompressed_size + 1 + xdef]);
+      memcpy(decompressed_buf.get(), chunk_ptr + xrep, xdef);
 
-      auto res = snappy::RawUncompress(chunk_buf.ptr + xrep + xdef,
+      auto res = snappy::RawUncompress(chunk_ptr + xrep + xdef,
                                        cs.page_header.compressed_page_size - xrep - xdef,
-                                       decompressed_buf.ptr + xdef);
+                                       decompressed_buf.get() + xdef);
       if (!res) {
         std::stringstream ss;
         ss << "Decompression failure, possibly corrupt Parquet file '"
@@ -1070,37 +1574,37 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
         throw runtime_error(ss.str());
       }
 
-      cs.page_buf_ptr = (char *)decompressed_buf.ptr;
+      cs.page_buf_ptr = (char *)decompressed_buf.get();
       cs.page_buf_len = cs.page_header.uncompressed_page_size - xrep;
 
       break;
     }
     case CompressionCodec::GZIP: {
       miniz::MiniZStream gzst;
-      decompressed_buf.resize(cs.page_header.uncompressed_page_size + 1 + xdef);
-      memcpy(decompressed_buf.ptr, chunk_buf.ptr + xrep, xdef);
+      decompressed_buf.reset(new char[cs.page_header.uncompressed_page_size + 1 + xdef]);
+      memcpy(decompressed_buf.get(), chunk_ptr + xrep, xdef);
 
       // throws on error
       gzst.Decompress(
-        (const char*) chunk_buf.ptr + xrep + xdef,
+        (const char*) chunk_ptr + xrep + xdef,
         cs.page_header.compressed_page_size - xrep - xdef,
-        (char*) decompressed_buf.ptr + xdef,
+        (char*) decompressed_buf.get() + xdef,
         cs.page_header.uncompressed_page_size - xrep - xdef
       );
 
-      cs.page_buf_ptr = (char *)decompressed_buf.ptr;
+      cs.page_buf_ptr = (char *)decompressed_buf.get();
       cs.page_buf_len = cs.page_header.uncompressed_page_size - xrep;
 
       break;
     }
     case CompressionCodec::ZSTD: {
-      decompressed_buf.resize(cs.page_header.uncompressed_page_size + 1 + xdef);
-      memcpy(decompressed_buf.ptr, chunk_buf.ptr + xrep, xdef);
+      decompressed_buf.reset(new char[cs.page_header.uncompressed_page_size + 1 + xdef]);
+      memcpy(decompressed_buf.get(), chunk_ptr + xrep, xdef);
 
       size_t res = zstd::ZSTD_decompress(
-        decompressed_buf.ptr + xdef,
+        decompressed_buf.get() + xdef,
         cs.page_header.uncompressed_page_size - xrep - xdef,
-        chunk_buf.ptr + xrep + xdef,
+        chunk_ptr + xrep + xdef,
         cs.page_header.compressed_page_size - xrep - xdef
       );
 
@@ -1112,7 +1616,7 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
         throw runtime_error(ss.str());
   		}
 
-      cs.page_buf_ptr = (char *)decompressed_buf.ptr;
+      cs.page_buf_ptr = (char *)decompressed_buf.get();
       cs.page_buf_len = cs.page_header.uncompressed_page_size - xrep;
 
       break;
@@ -1136,6 +1640,7 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
     case PageType::DATA_PAGE:
     case PageType::DATA_PAGE_V2: {
       cs.scan_data_page(result_col, has_def_levels);
+      pages_decoded++;
       break;
     }
 
@@ -1143,16 +1648,48 @@ void ParquetFile::scan_column(ScanState &state, ResultColumn &result_col) {
       break; // ignore INDEX page type and any other custom extensions
     }
 
-    chunk_buf.ptr = payload_end_ptr;
+    // dictionary strings point into the decompressed page, so the
+    // column keeps it.
+    // Uncompressed pages are kept by the ResultChunk or the memory map.
+    if (cs.page_buf_kept && decompressed_buf) {
+      result_col.string_heap_chunks.push_back(std::move(decompressed_buf));
+    }
+    cs.page_buf_kept = false;
+
+    chunk_ptr = payload_end_ptr;
     bytes_to_read -= cs.page_header.compressed_page_size;
   }
   cs.cleanup(result_col);
+  if (result_col.col->type == Type::BYTE_ARRAY ||
+      result_col.col->type == Type::FIXED_LEN_BYTE_ARRAY) {
+    result_col.finish_str(row_group.num_rows);
+  }
+
+  std::lock_guard<std::mutex> lock(io_mutex);
+  read_stats.pages_decoded += pages_decoded;
+  read_stats.pages_skipped += pages_skipped;
 }
 
-void ParquetFile::initialize_column(ResultColumn &col, uint64_t num_rows) {
-  col.defined.resize(num_rows, false);
-  memset(col.defined.ptr, 0, num_rows);
+void ParquetFile::initialize_column(ResultColumn &col, uint64_t num_rows,
+                                    void *sink) {
+  col.defined.resize(bitmap_bytes(num_rows), false);
+  memset(col.defined.ptr, 0, bitmap_bytes(num_rows));
+  col.dict.reset();
   col.string_heap_chunks.clear();
+  col.dict_mask.clear();
+  col.dict_na_match = false;
+  col.dict_none_match = false;
+  col.dict_rows.clear();
+  col.has_plain_pages = false;
+  if (!col.preds.empty() || col.keep_dict_offsets) {
+    col.dict_offsets.resize(sizeof(uint32_t) * num_rows, false);
+  }
+
+  col.sunk = sink != nullptr;
+  if (col.sunk) {
+    col.out = (char *) sink;
+    return;
+  }
 
   // TODO do some logical type checking here, we dont like map, list, enum,
   // json, bson etc
@@ -1177,7 +1714,10 @@ void ParquetFile::initialize_column(ResultColumn &col, uint64_t num_rows) {
     col.data.resize(sizeof(double) * num_rows, false);
     break;
   case Type::BYTE_ARRAY:
-    col.data.resize(sizeof(pair<uint32_t, char *>) * num_rows, false);
+    col.data.resize(sizeof(int64_t) * (num_rows + 1), false);
+    ((int64_t *) col.data.ptr)[0] = 0;
+    col.strings_len = 0;
+    col.strings_row = 0;
     break;
 
   case Type::FIXED_LEN_BYTE_ARRAY: {
@@ -1189,7 +1729,10 @@ void ParquetFile::initialize_column(ResultColumn &col, uint64_t num_rows) {
          << filename << "' @ " << __FILE__ << ":" << __LINE__;
       throw runtime_error(ss.str());
     }
-    col.data.resize(num_rows * sizeof(pair<uint32_t, char *>), false);
+    col.data.resize(sizeof(int64_t) * (num_rows + 1), false);
+    ((int64_t *) col.data.ptr)[0] = 0;
+    col.strings_len = 0;
+    col.strings_row = 0;
     break;
   }
 
@@ -1200,34 +1743,463 @@ void ParquetFile::initialize_column(ResultColumn &col, uint64_t num_rows) {
     throw runtime_error(ss.str());
   }
   }
+  col.out = col.data.ptr;
+}
+
+// Where to decode column `i` of the result for `range`, or nullptr if
+// it goes to ResultColumn::data. Row groups that are read partially
+// use ResultColumn::data, because the pages at the edges of the range
+// are decoded completely.
+
+void *ParquetFile::column_sink(const RowGroupRange &range,
+                               const ResultColumn &col, size_t i) {
+  if (i >= sinks.size() || sinks[i].ptr == nullptr || !filter.empty()) {
+    return nullptr;
+  }
+  if (range.from != 0 ||
+      range.to != (uint64_t) file_meta_data.row_groups[range.row_group].num_rows) {
+    return nullptr;
+  }
+  switch (col.col->type) {
+  case Type::BOOLEAN:
+  case Type::INT32:
+    return (int32_t *) sinks[i].ptr + range.offset;
+  case Type::DOUBLE:
+    return (double *) sinks[i].ptr + range.offset;
+  default:
+    return nullptr;
+  }
+}
+
+// The missing values of a sunk column, we fill the runs of unset bits
+// of the definition levels.
+
+template <class T>
+static void fill_na_runs(const uint64_t *defined, T *out, T na,
+                         uint64_t num_rows) {
+  uint64_t r = 0;
+  while ((r = bitmap_next(defined, r, num_rows, false)) < num_rows) {
+    uint64_t end = bitmap_next(defined, r, num_rows, true);
+    std::fill(out + r, out + end, na);
+    r = end;
+  }
+}
+
+void ParquetFile::fill_sink_na(ResultColumn &col, size_t i,
+                               uint64_t num_rows) {
+  if (col.col->type == Type::DOUBLE) {
+    fill_na_runs(col.defined_bits(), (double *) col.out,
+                 sinks[i].na_double, num_rows);
+  } else {
+    fill_na_runs(col.defined_bits(), (int32_t *) col.out,
+                 sinks[i].na_int, num_rows);
+  }
+}
+
+void ParquetFile::initialize_scan(ScanState &s) {
+  std::vector<uint64_t> row_groups(file_meta_data.row_groups.size());
+  std::iota(row_groups.begin(), row_groups.end(), 0);
+  initialize_scan(s, row_groups, 0, nrow);
+}
+
+// Row groups that are completely outside of [skip, skip + n_max) are
+// never read, using RowGroup.num_rows. The first and last row groups
+// may be partially covered, for these we only decode the pages that
+// have rows in the range. Row groups that cannot have rows that
+// satisfy the filter are not read, either. In this case s.nrow is only
+// an upper limit for the number of rows.
+
+void ParquetFile::initialize_scan(ScanState &s,
+                                  const std::vector<uint64_t> &row_groups,
+                                  uint64_t skip, uint64_t n_max) {
+  s.row_groups.clear();
+  s.reads.clear();
+  s.decodes.clear();
+  s.next_read = 0;
+  s.range_idx = 0;
+  s.nrow = 0;
+  uint64_t start = 0;
+  for (auto rg : row_groups) {
+    if (rg >= file_meta_data.row_groups.size()) {
+      std::stringstream ss;
+      ss << "Row group index " << rg << " out of range, Parquet file '"
+         << filename << "' has " << file_meta_data.row_groups.size()
+         << " row groups @ " << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
+    }
+    if (n_max == 0) break;
+    uint64_t rg_nrow = file_meta_data.row_groups[rg].num_rows;
+    uint64_t end = start + rg_nrow;
+    if (end <= skip) {
+      start = end;
+      continue;
+    }
+    uint64_t from = skip > start ? skip - start : 0;
+    uint64_t to = std::min(rg_nrow, from + n_max);
+    n_max -= to - from;
+    start = end;
+    if (!row_group_may_match(rg)) {
+      read_stats.row_groups_pruned++;
+      continue;
+    }
+    s.row_groups.push_back({ rg, from, to, s.nrow });
+    s.nrow += to - from;
+  }
+  s.initialized = true;
 }
 
 bool ParquetFile::scan(ScanState &s, ResultChunk &result) {
-  if (s.row_group_idx >= file_meta_data.row_groups.size()) {
+  if (!s.initialized) {
+    initialize_scan(s);
+  }
+  if (s.range_idx >= s.row_groups.size()) {
     result.nrows = 0;
+    result.row_from = result.row_to = 0;
     return false;
   }
 
-  auto &row_group = file_meta_data.row_groups[s.row_group_idx];
+  auto &range = s.row_groups[s.range_idx];
+  s.row_group_idx = range.row_group;
+
+  if (num_threads > 1 && s.row_groups.size() > 1) {
+    return scan_parallel(s, result);
+  }
+
+  // Start reading the current row group, unless it is being read
+  // already, plus the next `prefetch` ones in the background. The
+  // decoding (and the caller's conversion) of this row group then
+  // overlaps with the reading of the next ones.
+  std::vector<uint64_t> col_ids(result.cols.size());
+  for (size_t i = 0; i < result.cols.size(); i++) {
+    col_ids[i] = result.cols[i].id;
+  }
+  while (s.next_read < s.row_groups.size() &&
+         s.next_read <= s.range_idx + prefetch) {
+    RowGroupRange rg_range = s.row_groups[s.next_read];
+    auto policy = prefetch > 0 ? std::launch::async : std::launch::deferred;
+    s.reads.push_back(std::async(policy, [this, rg_range, col_ids]() {
+      std::unique_ptr<RowGroupData> data(new RowGroupData());
+      read_row_group(rg_range, col_ids, *data);
+      return data;
+    }));
+    s.next_read++;
+  }
+  // rethrows errors from the background thread
+  std::unique_ptr<RowGroupData> data = s.reads.front().get();
+  s.reads.pop_front();
+
+  // with a single row group we use the threads for the columns
+  decode_row_group(range, *data, result, num_threads);
+  // strings of uncompressed pages point into these
+  result.buffers = std::move(data->buffers);
+
+  s.range_idx++;
+  return true;
+}
+
+// Column chunks are independent, too, so with nthreads > 1 we decode
+// them concurrently. The threads take the next column from a shared
+// counter, so a few large columns don't leave the other threads idle.
+//
+// With a filter we decode in two phases. First the filter columns, and
+// then we evaluate the filter. Then the rest of the columns, but only
+// the pages that have selected rows, and for strings we only copy the
+// selected values. If no rows are selected, then the rest of the
+// columns are not decoded at all.
+
+void ParquetFile::decode_row_group(const RowGroupRange &range,
+                                   const RowGroupData &data,
+                                   ResultChunk &result, uint64_t nthreads) {
+  auto &row_group = file_meta_data.row_groups[range.row_group];
   result.nrows = row_group.num_rows;
+  result.row_from = range.from;
+  result.row_to = range.to;
+  result.paged = data.paged;
+  result.row_ranges = data.row_ranges;
+  size_t ncols = result.cols.size();
+  std::vector<size_t> filter_cols, other_cols;
+  for (size_t i = 0; i < ncols; i++) {
+    if (result.cols[i].preds.empty()) {
+      other_cols.push_back(i);
+    } else {
+      filter_cols.push_back(i);
+    }
+  }
+
+  // If the dictionary of a filter column shows that no row can match,
+  // then we don't decode the other filter columns, either.
+  std::atomic<bool> no_match(false);
+  auto decode_columns = [&](const std::vector<size_t> &cols,
+                            const uint8_t *wanted, bool skip) {
+    std::atomic<size_t> next_col(0);
+    auto work = [&]() {
+      size_t o;
+      while ((o = next_col++) < cols.size()) {
+        size_t i = cols[o];
+        auto &result_col = result.cols[i];
+        initialize_column(result_col, row_group.num_rows,
+                          column_sink(range, result_col, i));
+        if (skip || no_match) continue;
+        scan_column(range.row_group, result_col, data.chunks[i],
+                    data.use_pages[i] ? &data.pages[i] : nullptr, wanted,
+                    range.from, range.to);
+        if (result_col.sunk) {
+          fill_sink_na(result_col, i, row_group.num_rows);
+        }
+        if (result_col.dict_none_match && !result_col.has_plain_pages) {
+          no_match = true;
+        }
+      }
+    };
+
+    uint64_t nt = std::min(nthreads, (uint64_t) cols.size());
+    std::vector<std::future<void>> workers;
+    for (uint64_t t = 1; t < nt; t++) {
+      workers.push_back(std::async(std::launch::async, work));
+    }
+    // if this throws, the futures' destructors wait for the workers
+    work();
+    for (auto &w : workers) {
+      w.get();
+    }
+  };
+
+  decode_columns(filter_cols, nullptr, false);
+  filter_row_group(result);
+  std::vector<uint8_t> wanted;
+  if (result.filtered) {
+    wanted.resize(result.nrows, 0);
+    for (auto i : result.selected) {
+      wanted[i] = 1;
+    }
+  }
+  no_match = false;
+  decode_columns(
+    other_cols,
+    result.filtered ? wanted.data() : nullptr,
+    result.filtered && result.selected.empty()
+  );
+}
 
-  for (auto &result_col : result.cols) {
-    initialize_column(result_col, row_group.num_rows);
-    scan_column(s, result_col);
+// Row groups are independent, so with num_threads > 1 we read and decode
+// up to num_threads row groups concurrently, each into its own
+// ResultChunk, and hand them to the caller in order. The caller only
+// ever sees one ResultChunk, so it can do its conversion (e.g. to R
+// vectors, on the main thread) while the next row groups are decoded.
+// The ResultChunks that the caller is done with are reused. If there
+// are fewer row groups than threads, the rest of the threads decode
+// columns.
+
+bool ParquetFile::scan_parallel(ScanState &s, ResultChunk &result) {
+  uint64_t rg_threads = std::min(num_threads, (uint64_t) s.row_groups.size());
+  uint64_t col_threads = num_threads / rg_threads;
+  std::vector<uint64_t> col_ids(result.cols.size());
+  for (size_t i = 0; i < result.cols.size(); i++) {
+    col_ids[i] = result.cols[i].id;
+  }
+  while (s.next_read < s.row_groups.size() &&
+         s.next_read < s.range_idx + rg_threads) {
+    RowGroupRange range = s.row_groups[s.next_read];
+    ResultChunk *chunk;
+    if (s.free_chunks.empty()) {
+      chunk = new ResultChunk();
+      initialize_result(*chunk, col_ids);
+    } else {
+      chunk = s.free_chunks.back().release();
+      s.free_chunks.pop_back();
+    }
+    s.decodes.push_back(std::async(std::launch::async,
+                                   [this, range, chunk, col_threads]() {
+      std::unique_ptr<ResultChunk> result(chunk);
+      std::vector<uint64_t> col_ids(result->cols.size());
+      for (size_t i = 0; i < result->cols.size(); i++) {
+        col_ids[i] = result->cols[i].id;
+      }
+      RowGroupData data;
+      read_row_group(range, col_ids, data);
+      decode_row_group(range, data, *result, col_threads);
+      result->buffers = std::move(data.buffers);
+      return result;
+    }));
+    s.next_read++;
   }
 
-  s.row_group_idx++;
+  // rethrows errors from the worker thread
+  std::unique_ptr<ResultChunk> done = s.decodes.front().get();
+  s.decodes.pop_front();
+  std::swap(result.cols, done->cols);
+  result.nrows = done->nrows;
+  result.row_from = done->row_from;
+  result.row_to = done->row_to;
+  result.filtered = done->filtered;
+  std::swap(result.selected, done->selected);
+  result.paged = done->paged;
+  std::swap(result.row_ranges, done->row_ranges);
+  std::swap(result.buffers, done->buffers);
+  s.free_chunks.push_back(std::move(done));
+
+  s.range_idx++;
   return true;
 }
 
+// Statistics are cheap to check, they are in the metadata. Bloom
+// filters need a read, so we only look at them if the statistics did
+// not rule out the row group, for == and %in% predicates, where they
+// help with high cardinality columns, e.g. IDs.
+
+bool ParquetFile::row_group_may_match(uint64_t row_group_idx) {
+  auto &row_group = file_meta_data.row_groups[row_group_idx];
+  for (auto &pred : filter) {
+    auto &cmd = row_group.columns[pred.column].meta_data;
+    ValueStats stats = column_chunk_stats(cmd);
+    if (!stats_may_match(pred, stats)) {
+      return false;
+    }
+    // the bloom filter does not know about NAs, and NaN values may have
+    // any bit pattern
+    bool is_float = pred.type == Type::FLOAT || pred.type == Type::DOUBLE;
+    bool na_may_match = pred.op == FilterOp::IN &&
+      (pred.match_nan || (pred.match_na &&
+        (is_float || !(stats.has_null_count && stats.null_count == 0))));
+    if ((pred.op == FilterOp::EQ || pred.op == FilterOp::IN) &&
+        !na_may_match && !bloom_may_match(pred, row_group.columns[pred.column])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParquetFile::bloom_may_match(const Predicate &pred,
+                                  const ColumnChunk &chunk) {
+  auto &cmd = chunk.meta_data;
+  if (!cmd.__isset.bloom_filter_offset || cmd.bloom_filter_offset < 0 ||
+      (uint64_t) cmd.bloom_filter_offset >= file_size) {
+    return true;
+  }
+  int64_t offset = cmd.bloom_filter_offset;
+  std::unique_ptr<char[]> buf;
+  const char *ptr;
+  uint32_t header_len;
+  BloomFilterHeader header;
+  if (cmd.__isset.bloom_filter_length && cmd.bloom_filter_length > 0) {
+    ptr = read_bytes(offset, cmd.bloom_filter_length, buf);
+    header_len = cmd.bloom_filter_length;
+    thrift_unpack((const uint8_t *) ptr, &header_len, &header, filename);
+  } else {
+    // older writers do not write the length, read the header first,
+    // it is short
+    int64_t len = std::min((int64_t) 256, (int64_t) file_size - offset);
+    ptr = read_bytes(offset, len, buf);
+    header_len = len;
+    thrift_unpack((const uint8_t *) ptr, &header_len, &header, filename);
+    if (header.numBytes <= 0 ||
+        (uint64_t) offset + header_len + header.numBytes > file_size) {
+      return true;
+    }
+    ptr = read_bytes(offset, header_len + header.numBytes, buf);
+  }
+  if (!header.algorithm.__isset.BLOCK || !header.hash.__isset.XXHASH ||
+      !header.compression.__isset.UNCOMPRESSED || header.numBytes <= 0 ||
+      (cmd.__isset.bloom_filter_length &&
+       cmd.bloom_filter_length > 0 &&
+       header_len + (int64_t) header.numBytes > cmd.bloom_filter_length)) {
+    return true;
+  }
+  return bloom_filter_may_match(pred, (const uint8_t *) ptr + header_len,
+                                header.numBytes);
+}
+
+void ParquetFile::filter_row_group(ResultChunk &result) {
+  result.selected.clear();
+  result.filtered = !filter.empty();
+  if (!result.filtered) return;
+
+  // with the page index only rows in row_ranges may match, the other
+  // rows were not even decoded
+  std::vector<RowRange> all = { { result.row_from, result.row_to } };
+  const std::vector<RowRange> &ranges = result.paged ? result.row_ranges : all;
+  std::vector<uint8_t> keep(result.nrows, 1);
+  auto by_value = [&](const ResultColumn &col, uint64_t from, uint64_t to) {
+    for (auto pred : col.preds) {
+      evaluate_predicate(*pred, col, from, to, keep.data());
+    }
+  };
+
+  for (auto &col : result.cols) {
+    if (col.preds.empty()) continue;
+    const uint32_t *offsets = (const uint32_t *) col.dict_offsets.ptr;
+    for (auto &r : ranges) {
+      if (col.dict_mask.empty()) {
+        by_value(col, r.from, r.to);
+        continue;
+      }
+      // rows of dictionary encoded pages are filtered by their
+      // dictionary index, the rest by value
+      uint64_t pos = r.from;
+      for (auto &dr : col.dict_rows) {
+        uint64_t from = std::max(dr.from, r.from);
+        uint64_t to = std::min(dr.to, r.to);
+        if (from >= to) continue;
+        if (pos < from) by_value(col, pos, from);
+        for (uint64_t i = from; i < to; i++) {
+          keep[i] = keep[i] &&
+            (col.is_defined(i) ? col.dict_mask[offsets[i]] : col.dict_na_match);
+        }
+        pos = to;
+      }
+      if (pos < r.to) by_value(col, pos, r.to);
+    }
+  }
+
+  for (auto &r : ranges) {
+    for (uint64_t i = r.from; i < r.to; i++) {
+      if (keep[i]) result.selected.push_back(i);
+    }
+  }
+}
+
 void ParquetFile::initialize_result(ResultChunk &result) {
-  result.nrows = 0;
-  result.cols.resize(columns.size());
-  for (size_t col_idx = 0; col_idx < columns.size(); col_idx++) {
-    // result.cols[col_idx].type = columns[col_idx]->type;
-    result.cols[col_idx].col = columns[col_idx].get();
+  std::vector<uint64_t> col_select(columns.size());
+  std::iota(col_select.begin(), col_select.end(), 0);
+  initialize_result(result, col_select);
+}
+
+// Only the selected columns get a ResultColumn, so scan() never reads,
+// decompresses or decodes the column chunks of the other columns.
+
+void ParquetFile::initialize_result(ResultChunk &result,
+                                    const std::vector<uint64_t> &col_select) {
+  // we also need to decode the filter columns, these come after the
+  // selected ones
+  std::vector<uint64_t> col_ids(col_select);
+  for (auto &pred : filter) {
+    if (std::find(col_ids.begin(), col_ids.end(), pred.column) ==
+        col_ids.end()) {
+      col_ids.push_back(pred.column);
+    }
+  }
 
-    result.cols[col_idx].id = col_idx;
+  result.nrows = 0;
+  result.cols.resize(col_ids.size());
+  for (size_t idx = 0; idx < col_ids.size(); idx++) {
+    uint64_t col_idx = col_ids[idx];
+    if (col_idx >= columns.size()) {
+      std::stringstream ss;
+      ss << "Column index " << col_idx << " out of range, Parquet file '"
+         << filename << "' has " << columns.size() << " columns @ "
+         << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
+    }
+    result.cols[idx].col = columns[col_idx].get();
+    result.cols[idx].id = col_idx;
+    result.cols[idx].preds.clear();
+    result.cols[idx].keep_dict_offsets =
+      col_idx < keep_dict_offsets.size() && keep_dict_offsets[col_idx];
+    for (auto &pred : filter) {
+      if (pred.column == col_idx) {
+        result.cols[idx].preds.push_back(&pred);
+      }
+    }
   }
 }
 
@@ -1238,18 +2210,30 @@ ParquetFile::read_page_header(int64_t pos) {
   if (len > file_size - pos) {
     len = file_size - pos - 4;
   }
-  tmp_buf.resize(len);
-  pfile.seekg(pos, ios_base::beg);
-  pfile.read(tmp_buf.ptr, len);
-  if (pfile.eof()) {
-    std::stringstream ss;
-    ss << "End of file while reading, possibly corrupt Parquet file '"
-       << filename << "; @ " << __FILE__ << ":" << __LINE__;
-    throw runtime_error(ss.str());
+  const char *ptr;
+  if (mmap_file.is_open()) {
+    if (pos < 0 || (uint64_t) pos + len > file_size) {
+      std::stringstream ss;
+      ss << "End of file while reading, possibly corrupt Parquet file '"
+         << filename << "; @ " << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
+    }
+    ptr = mmap_file.data() + pos;
+  } else {
+    tmp_buf.resize(len);
+    pfile.seekg(pos, ios_base::beg);
+    pfile.read(tmp_buf.ptr, len);
+    if (pfile.eof()) {
+      std::stringstream ss;
+      ss << "End of file while reading, possibly corrupt Parquet file '"
+         << filename << "; @ " << __FILE__ << ":" << __LINE__;
+      throw runtime_error(ss.str());
+    }
+    ptr = tmp_buf.ptr;
   }
   PageHeader ph;
   uint32_t ph_size = len;
-  thrift_unpack((const uint8_t *) tmp_buf.ptr, &ph_size, &ph, filename);
+  thrift_unpack((const uint8_t *) ptr, &ph_size, &ph, filename);
   return std::make_pair(ph, ph_size);
 }
 
@@ -1260,6 +2244,10 @@ void ParquetFile::read_chunk(int64_t offset, int64_t size, int8_t *buffer) {
        << filename << "' @ " << __FILE__ << ":" << __LINE__;
     throw runtime_error(ss.str());
   }
-  pfile.seekg(offset, ios_base::beg);
-  pfile.read((char*) buffer, size);
+  if (mmap_file.is_open()) {
+    memcpy(buffer, mmap_file.data() + offset, size);
+  } else {
+    pfile.seekg(offset, ios_base::beg);
+    pfile.read((char*) buffer, size);
+  }
 }
@@ -1,6 +1,9 @@
 #include <bitset>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -8,6 +11,10 @@
 #include <transport/TBufferTransports.h>
 
 #include "parquet/parquet_types.h"
+#include "bitmap.h"
+#include "Filter.h"
+#include "MemoryMap.h"
+#include "RandomAccessFile.h"
 
 namespace nanoparquet {
 
@@ -35,46 +42,264 @@ public:
   }
 };
 
-class ScanState {
-public:
-  uint64_t row_group_idx = 0;
-  uint64_t row_group_offset = 0;
+// rows [from, to) of a row group
+struct RowGroupRange {
+  uint64_t row_group;
+  uint64_t from;
+  uint64_t to;
+  // position of row `from` in the output, if there is no filter
+  uint64_t offset;
+};
+
+// A preallocated output vector for a column, e.g. an R vector. For
+// row groups that are read completely, and if there is no filter,
+// INT32 and BOOLEAN values are decoded directly into it as int32_t,
+// DOUBLE values as double, at the row group's offset, and missing
+// values are set to na_int or na_double. The caller should not copy
+// these columns from ResultColumn::data (ResultColumn::sunk is set).
+struct ColumnSink {
+  void *ptr;
+  int32_t na_int;
+  double na_double;
+};
+
+// rows [from, to) of a row group
+struct RowRange {
+  uint64_t from;
+  uint64_t to;
+};
+
+// A contiguous run of pages of a column chunk, found via the offset
+// index. first_row is the first row of the first data page, or -1 if
+// the run has no data pages, e.g. it is the dictionary page.
+struct PageRun {
+  int64_t offset;
+  int64_t len;
+  int64_t first_row;
+  const char *ptr;
+};
+
+// The raw bytes of the column chunks of a row group. chunks has one
+// pointer for each ResultColumn, into buffers or into the memory map.
+// If use_pages[i] is set, then we only have the pages in pages[i] for
+// column i, instead of the whole column chunk.
+struct RowGroupData {
+  uint64_t row_group;
+  std::vector<const char *> chunks;
+  std::vector<std::unique_ptr<char[]>> buffers;
+  std::vector<uint8_t> use_pages;
+  std::vector<std::vector<PageRun>> pages;
+  // if paged is set, the filter only matches rows in row_ranges
+  bool paged = false;
+  std::vector<RowRange> row_ranges;
 };
 
 struct ResultColumn {
   uint64_t id;
   ByteBuffer data;
+  // where the values are decoded to, data.ptr, or the ColumnSink
+  char *out = nullptr;
+  bool sunk = false;
   ParquetColumn *col;
+  // bitmap, the rows that are not missing, see bitmap.h
   ByteBuffer defined;
+  const uint64_t *defined_bits() const {
+    return (const uint64_t *) defined.ptr;
+  }
+  bool is_defined(uint64_t i) const {
+    return bitmap_get(defined_bits(), i);
+  }
+  // the dictionary strings point into these pages
   std::vector<std::unique_ptr<char[]>> string_heap_chunks;
   std::unique_ptr<Dictionary<std::pair<uint32_t, char *>>> dict = nullptr;
+
+  // BYTE_ARRAY and FIXED_LEN_BYTE_ARRAY values are in the Arrow large
+  // binary layout: data has num_rows + 1 int64_t offsets, and the bytes
+  // of row i are [offsets[i], offsets[i + 1]) in strings. Missing values
+  // and rows that were not decoded are empty. With keep_dict_offsets
+  // the rows of the dictionary encoded pages are empty, too, their
+  // values are in dict, at dict_offsets.
+  ByteBuffer strings;
+  uint64_t strings_len = 0;
+  // the offsets are set up to this row
+  uint64_t strings_row = 0;
+
+  const int64_t *str_offsets() const {
+    return (const int64_t *) data.ptr;
+  }
+  const char *str_ptr(uint64_t i) const {
+    return strings.ptr + str_offsets()[i];
+  }
+  uint32_t str_len(uint64_t i) const {
+    return str_offsets()[i + 1] - str_offsets()[i];
+  }
+  // Room for the `len` bytes of row `row`. Rows must be added in
+  // increasing order, the rows in between are empty.
+  char *add_str(uint64_t row, uint32_t len);
+  void reserve_str(uint64_t len);
+  // sets up the offsets of the remaining rows
+  void finish_str(uint64_t num_rows);
+
+  // The filter predicates on this column. For dictionary encoded
+  // pages these are evaluated once for each dictionary entry, into
+  // dict_mask, and the rows of these pages (dict_rows) are filtered by
+  // their dictionary index (in dict_offsets), instead of by value.
+  // dict_offsets and dict_rows are also kept for the columns selected
+  // in ParquetFile::keep_dict_offsets.
+  std::vector<const Predicate *> preds;
+  bool keep_dict_offsets = false;
+  std::vector<uint8_t> dict_mask;
+  // do missing values satisfy all predicates?
+  bool dict_na_match = false;
+  // no dictionary entry matches, so the dictionary encoded pages were
+  // not decoded at all
+  bool dict_none_match = false;
+  ByteBuffer dict_offsets;
+  std::vector<RowRange> dict_rows;
+  // there were data pages that are not dictionary encoded
+  bool has_plain_pages = false;
 };
 
 struct ResultChunk {
   std::vector<ResultColumn> cols;
   uint64_t nrows;
+  // the rows of the row group that were requested, only these are
+  // guaranteed to be decoded
+  uint64_t row_from = 0;
+  uint64_t row_to = 0;
+  // if there is a filter, then only these rows of [row_from, row_to)
+  // are selected
+  bool filtered = false;
+  std::vector<uint32_t> selected;
+  // if paged is set, the page index showed that only the rows in
+  // row_ranges may satisfy the filter, and only pages with these rows
+  // were decoded
+  bool paged = false;
+  std::vector<RowRange> row_ranges;
+  // the column chunks that were read into memory (i.e. not mapped),
+  // the strings of uncompressed pages point into these
+  std::vector<std::unique_ptr<char[]>> buffers;
+};
+
+class ScanState {
+public:
+  // the row groups to read, set up by ParquetFile::initialize_scan(),
+  // all row groups, all rows if it was not called
+  std::vector<RowGroupRange> row_groups;
+  bool initialized = false;
+  uint64_t nrow = 0;
+  uint64_t range_idx = 0;
+  // current row group
+  uint64_t row_group_idx = 0;
+  // row groups that are being read in the background, starting with
+  // the one at range_idx, and the index of the next range to read
+  std::deque<std::future<std::unique_ptr<RowGroupData>>> reads;
+  uint64_t next_read = 0;
+  // with multiple threads: row groups that are being read and decoded,
+  // and decoded chunks that can be reused
+  std::deque<std::future<std::unique_ptr<ResultChunk>>> decodes;
+  std::vector<std::unique_ptr<ResultChunk>> free_chunks;
+};
+
+// I/O statistics of the read planner. Without the planner we would do
+// num_chunks reads, instead of num_reads.
+struct ReadStats {
+  uint64_t num_chunks = 0;
+  uint64_t num_reads = 0;
+  uint64_t bytes_read = 0;
+  // row groups skipped because of the filter
+  uint64_t row_groups_pruned = 0;
+  // data pages skipped because of the filter, using the page index
+  uint64_t pages_pruned = 0;
+  // data pages decoded, and data pages skipped in a column chunk that
+  // we decode, because the filter selected none of their rows
+  uint64_t pages_decoded = 0;
+  uint64_t pages_skipped = 0;
 };
 
 class ParquetFile {
 public:
-  ParquetFile(std::string filename);
+  // If use_mmap is true, the file is memory mapped and column chunks
+  // and page headers are addressed directly in the mapping. If the
+  // mapping fails we fall back to reading the file with a stream.
+  ParquetFile(std::string filename, bool use_mmap = false);
   void read_checks();
   void initialize_result(ResultChunk &result);
+  void initialize_result(ResultChunk &result,
+                         const std::vector<uint64_t> &col_select);
+  void initialize_scan(ScanState &s);
+  void initialize_scan(ScanState &s, const std::vector<uint64_t> &row_groups,
+                       uint64_t skip, uint64_t n_max);
   bool scan(ScanState &s, ResultChunk &result);
   uint64_t nrow;
   std::vector<std::unique_ptr<ParquetColumn>> columns;
+  // column chunks closer than this many bytes are read with a single read
+  uint64_t read_gap = 64 * 1024;
+  // number of row groups to read ahead on a background thread, while the
+  // current one is decoded. Zero turns off prefetching.
+  uint64_t prefetch = 1;
+  // number of threads to read and decode row groups and column chunks
+  // on. If more than one, and there are multiple row groups, prefetch
+  // is not used.
+  uint64_t num_threads = 1;
+  ReadStats read_stats;
+  // Only read the rows that satisfy all of these. Set it before calling
+  // initialize_result() and initialize_scan(). Row groups are skipped
+  // based on the statistics in the metadata, if possible.
+  std::vector<Predicate> filter;
+  // Keep the dictionary indices of the rows of dictionary encoded
+  // pages, for these columns (indexed by column id), so the caller can
+  // convert each dictionary entry only once, instead of once per row.
+  // Set it before calling initialize_result().
+  std::vector<bool> keep_dict_offsets;
+  // One for each column of the result, or empty. A ColumnSink with a
+  // null ptr means no sink for that column. Only used if there is no
+  // filter.
+  std::vector<ColumnSink> sinks;
   parquet::FileMetaData file_meta_data;
   std::pair<parquet::PageHeader, int64_t> read_page_header(int64_t pos);
   void read_chunk(int64_t offset, int64_t size, int8_t *buffer);
 
 private:
   std::string filename;
-  void initialize(std::string filename);
-  void initialize_column(ResultColumn &col, uint64_t num_rows);
-  void scan_column(ScanState &state, ResultColumn &result_col);
+  void initialize(std::string filename, bool use_mmap);
+  void initialize_column(ResultColumn &col, uint64_t num_rows,
+                         void *sink = nullptr);
+  void *column_sink(const RowGroupRange &range, const ResultColumn &col,
+                    size_t i);
+  void fill_sink_na(ResultColumn &col, size_t i, uint64_t num_rows);
+  void column_chunk_range(const parquet::ColumnChunk &chunk,
+                          int64_t &chunk_start, int64_t &chunk_len);
+  void read_row_group(const RowGroupRange &range,
+                      const std::vector<uint64_t> &col_ids,
+                      RowGroupData &data);
+  const char *read_bytes(int64_t offset, int64_t len,
+                         std::unique_ptr<char[]> &buf);
+  bool select_pages(const RowGroupRange &range,
+                    const std::vector<uint64_t> &col_ids,
+                    RowGroupData &data);
+  // pfile and read_stats are shared by the reader threads
+  std::mutex io_mutex;
+  void decode_row_group(const RowGroupRange &range,
+                        const RowGroupData &data, ResultChunk &result,
+                        uint64_t nthreads);
+  bool scan_parallel(ScanState &s, ResultChunk &result);
+  bool row_group_may_match(uint64_t row_group_idx);
+  bool bloom_may_match(const Predicate &pred,
+                       const parquet::ColumnChunk &chunk);
+  void filter_row_group(ResultChunk &result);
+  void scan_column(uint64_t row_group_idx, ResultColumn &result_col,
+                   const char *chunk_ptr, const std::vector<PageRun> *pages,
+                   const uint8_t *wanted, uint64_t row_from,
+                   uint64_t row_to);
   std::ifstream pfile;
   ByteBuffer tmp_buf;
   uint64_t file_size;
+
+  // memory mapped file, not open if we are reading with pfile
+  MemoryMap mmap_file;
+  // for reading column chunks, if not memory mapped
+  RandomAccessFile rafile;
 };
 
 } // namespace nanoparquet
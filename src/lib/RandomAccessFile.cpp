@@ -0,0 +1,93 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "RandomAccessFile.h"
+
+using namespace nanoparquet;
+
+#ifdef _WIN32
+
+bool RandomAccessFile::open(const std::string &filename) {
+  close();
+  HANDLE fh = CreateFileA(
+    filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, NULL
+  );
+  if (fh == INVALID_HANDLE_VALUE) return false;
+  handle = fh;
+  return true;
+}
+
+void RandomAccessFile::close() {
+  if (handle != nullptr) {
+    CloseHandle((HANDLE) handle);
+    handle = nullptr;
+  }
+}
+
+bool RandomAccessFile::is_open() const {
+  return handle != nullptr;
+}
+
+// ReadFile() with an OVERLAPPED offset does not use the file pointer
+// for synchronous handles, so this is safe to call concurrently.
+
+bool RandomAccessFile::read_at(uint64_t offset, uint64_t size,
+                               char *buffer) {
+  while (size > 0) {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD) size;
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD) (offset & 0xffffffff);
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    DWORD nread = 0;
+    if (!ReadFile((HANDLE) handle, buffer, chunk, &nread, &ov) ||
+        nread == 0) {
+      return false;
+    }
+    offset += nread;
+    size -= nread;
+    buffer += nread;
+  }
+  return true;
+}
+
+#else
+
+bool RandomAccessFile::open(const std::string &filename) {
+  close();
+  fd = ::open(filename.c_str(), O_RDONLY);
+  return fd != -1;
+}
+
+void RandomAccessFile::close() {
+  if (fd != -1) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool RandomAccessFile::is_open() const {
+  return fd != -1;
+}
+
+bool RandomAccessFile::read_at(uint64_t offset, uint64_t size,
+                               char *buffer) {
+  while (size > 0) {
+    ssize_t nread = pread(fd, buffer, size, offset);
+    if (nread == -1 && errno == EINTR) continue;
+    if (nread <= 0) return false;
+    offset += nread;
+    size -= nread;
+    buffer += nread;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace nanoparquet {
+
+// Read-only file with positional reads. Unlike an std::ifstream it has
+// no file position, so multiple threads can read from it at the same
+// time. open() returns false if the file cannot be opened.
+
+class RandomAccessFile {
+public:
+  RandomAccessFile() { }
+  ~RandomAccessFile() { close(); }
+  RandomAccessFile(const RandomAccessFile &) = delete;
+  RandomAccessFile &operator=(const RandomAccessFile &) = delete;
+
+  bool open(const std::string &filename);
+  void close();
+  bool is_open() const;
+  // reads exactly size bytes, returns false on error or short read
+  bool read_at(uint64_t offset, uint64_t size, char *buffer);
+
+private:
+#ifdef _WIN32
+  void *handle = nullptr;
+#else
+  int fd = -1;
+#endif
+};
+
+} // namespace nanoparquet
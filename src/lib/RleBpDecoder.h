@@ -3,9 +3,18 @@
 #include <cstdint>
 
 #include "nanoparquet.h"
+#include "bitmap.h"
+#include "fastpforlib/bitpackinghelpers.h"
 
 using namespace std;
 
+// A run of repeated values in the output of RleBpDecoder::GetBatch():
+// the index of the first value, and the number of values.
+struct RleRun {
+  uint32_t from;
+  uint32_t len;
+};
+
 // adapted from arrow parquet reader
 class RleBpDecoder {
 public:
@@ -24,7 +33,12 @@ public:
   }
 
   /// Gets a batch of values.  Returns the number of decoded elements.
-  template <typename T> inline int GetBatch(T *values, int batch_size) {
+  /// If `runs` is not null, then the repeated runs of at least
+  /// kMinRun values are added to it, so the caller can process them
+  /// at once.
+  static constexpr uint32_t kMinRun = 8;
+  template <typename T> inline int GetBatch(T *values, int batch_size,
+                                            std::vector<RleRun> *runs = nullptr) {
     uint32_t values_read = 0;
 
     while (values_read < batch_size) {
@@ -33,6 +47,9 @@ public:
                                     static_cast<uint32_t>(repeat_count_));
         std::fill(values + values_read, values + values_read + repeat_batch,
                   static_cast<T>(current_value_));
+        if (runs && repeat_batch >= kMinRun) {
+          runs->push_back(RleRun{ values_read, (uint32_t) repeat_batch });
+        }
         repeat_count_ -= repeat_batch;
         values_read += repeat_batch;
       } else if (literal_count_ > 0) {
@@ -53,17 +70,51 @@ public:
     return values_read;
   }
 
+  /// Decodes `n` values of bit width one into bits [from, from + n)
+  /// of a bitmap, e.g. definition levels. These bits must be zero.
+  /// Repeated runs set whole words, and bit-packed runs are already in
+  /// the bitmap's bit order, so we copy them 64 bits at a time.
+  inline uint32_t GetBitmap(uint64_t *bits, uint64_t from, uint32_t n) {
+    if (bit_width_ != 1) {
+      throw runtime_error("Bitmaps need a bit width of one");
+    }
+    uint32_t values_read = 0;
+    while (values_read < n) {
+      if (repeat_count_ > 0) {
+        uint32_t repeat_batch = std::min(n - values_read, repeat_count_);
+        if (current_value_) {
+          bitmap_set(bits, from + values_read, repeat_batch);
+        }
+        repeat_count_ -= repeat_batch;
+        values_read += repeat_batch;
+      } else if (literal_count_ > 0) {
+        uint32_t literal_batch = std::min(n - values_read, literal_count_);
+        bitmap_or_packed(bits, from + values_read, buffer, literal_batch);
+        buffer += (literal_batch + 7) / 8;
+        literal_count_ -= literal_batch;
+        values_read += literal_batch;
+      } else {
+        if (!NextCounts<uint8_t>())
+          return values_read;
+      }
+    }
+    return values_read;
+  }
+
+  /// Decodes the values of the rows that are set in the `defined`
+  /// bitmap, from bit `from`, into `out`, and skips the rest of `out`.
   template <typename T>
   inline int GetBatchSpaced(uint32_t batch_size, uint32_t null_count,
-                            const uint8_t *defined, T *out) {
+                            const uint64_t *defined, uint64_t from,
+                            T *out) {
     //  DCHECK_GE(bit_width_, 0);
     uint32_t values_read = 0;
     uint32_t remaining_nulls = null_count;
 
-    uint32_t d_off = 0; // defined_offset
+    uint64_t d_off = from; // defined_offset
 
     while (values_read < batch_size) {
-      bool is_valid = defined[d_off++];
+      bool is_valid = bitmap_get(defined, d_off++);
 
       if (is_valid) {
         if ((repeat_count_ == 0) && (literal_count_ == 0)) {
@@ -78,7 +129,7 @@ public:
 
           while (repeat_count_ > 0 &&
                  (values_read + repeat_batch) < batch_size) {
-            if (defined[d_off]) {
+            if (bitmap_get(defined, d_off)) {
               repeat_count_--;
             } else {
               remaining_nulls--;
@@ -111,7 +162,7 @@ public:
 
           // Read the first bitset to the end
           while (literals_read < literal_batch) {
-            if (defined[d_off]) {
+            if (bitmap_get(defined, d_off)) {
               *out = indices[literals_read];
               literals_read++;
             } else {
@@ -204,10 +255,39 @@ private:
   static const uint32_t BITPACK_MASKS[];
   static const uint8_t BITPACK_DLEN;
 
+  // Unpack 32 values with fastpforlib, if it has an unpacker for the
+  // type and the bit width. 32 values take exactly 4 * bit_width_
+  // bytes.
+  bool FastUnpack32(uint32_t *dest) {
+    fastpforlib::fastunpack((const uint32_t *) buffer, dest, bit_width_);
+    return true;
+  }
+  bool FastUnpack32(uint8_t *dest) {
+    if (bit_width_ > 8) return false;
+    fastpforlib::fastunpack(buffer, dest, bit_width_);
+    return true;
+  }
+  bool FastUnpack32(bool *dest) {
+    return FastUnpack32((uint8_t *) dest);
+  }
+  template <typename T> bool FastUnpack32(T *dest) {
+    return false;
+  }
+
   template <typename T>
   uint32_t BitUnpack(T *dest, uint32_t count) {
     assert(bit_width_ < 32);
 
+    // literal runs are multiples of 8 values, so they start at a byte
+    // boundary, and we can unpack them in blocks of 32 values, the
+    // rest one by one
+    uint32_t total = count;
+    while (count >= 32 && FastUnpack32(dest)) {
+      buffer += bit_width_ * 4;
+      dest += 32;
+      count -= 32;
+    }
+
     int8_t bitpack_pos = 0;
     auto source = buffer;
     auto mask = BITPACK_MASKS[bit_width_];
@@ -224,6 +304,6 @@ private:
     }
 
     buffer += bit_width_ * count / 8;
-    return count;
+    return total;
   }
 };
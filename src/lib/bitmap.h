@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Bitmaps of uint64_t words, bit i is bit (i % 64) of word i / 64.
+// The definition levels of flat columns are zero or one, so we keep
+// them as a bitmap, one bit per row, and count and skip the missing
+// values 64 at a time.
+
+// Bytes for a bitmap of n bits. We add an extra word, so the last word
+// can always be read and written as a whole.
+static inline uint64_t bitmap_bytes(uint64_t n) {
+  return (n / 64 + 2) * sizeof(uint64_t);
+}
+
+static inline bool bitmap_get(const uint64_t *bits, uint64_t i) {
+  return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static inline int bitmap_ctz(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(w);
+#else
+  int n = 0;
+  while (!(w & 1)) { w >>= 1; n++; }
+  return n;
+#endif
+}
+
+static inline int bitmap_popcount(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(w);
+#else
+  w = w - ((w >> 1) & 0x5555555555555555ULL);
+  w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+  w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (w * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+// Sets bits [from, from + n).
+static inline void bitmap_set(uint64_t *bits, uint64_t from, uint64_t n) {
+  if (n == 0) return;
+  uint64_t to = from + n;
+  uint64_t fw = from / 64, tw = (to - 1) / 64;
+  uint64_t fmask = ~0ULL << (from % 64);
+  uint64_t tmask = ~0ULL >> (63 - (to - 1) % 64);
+  if (fw == tw) {
+    bits[fw] |= fmask & tmask;
+    return;
+  }
+  bits[fw] |= fmask;
+  for (uint64_t w = fw + 1; w < tw; w++) bits[w] = ~0ULL;
+  bits[tw] |= tmask;
+}
+
+// Number of set bits in [from, from + n).
+static inline uint64_t bitmap_count(const uint64_t *bits, uint64_t from,
+                                    uint64_t n) {
+  if (n == 0) return 0;
+  uint64_t to = from + n;
+  uint64_t fw = from / 64, tw = (to - 1) / 64;
+  uint64_t fmask = ~0ULL << (from % 64);
+  uint64_t tmask = ~0ULL >> (63 - (to - 1) % 64);
+  if (fw == tw) return bitmap_popcount(bits[fw] & fmask & tmask);
+  uint64_t count = bitmap_popcount(bits[fw] & fmask);
+  for (uint64_t w = fw + 1; w < tw; w++) count += bitmap_popcount(bits[w]);
+  return count + bitmap_popcount(bits[tw] & tmask);
+}
+
+// The first set (if `set`) or unset bit in [i, to), or `to`.
+static inline uint64_t bitmap_next(const uint64_t *bits, uint64_t i,
+                                   uint64_t to, bool set) {
+  uint64_t flip = set ? 0 : ~0ULL;
+  while (i < to) {
+    uint64_t w = (bits[i / 64] ^ flip) >> (i % 64);
+    if (w != 0) {
+      i += bitmap_ctz(w);
+      return i < to ? i : to;
+    }
+    i = (i / 64 + 1) * 64;
+  }
+  return to;
+}
+
+// ORs n bits from src, in the Parquet bit-packed (LSB first) order,
+// into bits [from, from + n). The destination bits must be zero.
+static inline void bitmap_or_packed(uint64_t *bits, uint64_t from,
+                                    const uint8_t *src, uint64_t n) {
+  uint64_t *dst = bits + from / 64;
+  unsigned shift = from % 64;
+  for (; n >= 64; n -= 64, src += 8, dst++) {
+    uint64_t w;
+    memcpy(&w, src, sizeof(w));
+    dst[0] |= w << shift;
+    if (shift) dst[1] |= w >> (64 - shift);
+  }
+  if (n == 0) return;
+  uint64_t w = 0;
+  memcpy(&w, src, (n + 7) / 8);
+  w &= ~0ULL >> (64 - n);
+  dst[0] |= w << shift;
+  if (shift && shift + n > 64) dst[1] |= w >> (64 - shift);
+}
@@ -5,6 +5,10 @@
 
 #include "fastpforlib/bitpackinghelpers.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 struct buffer {
   uint8_t *start;
   uint32_t len;
@@ -19,7 +23,7 @@ T uleb_decode(buffer *buf) {
       throw runtime_error("Buffer ended while varint decoding");
     }
     auto byte = *buf->start++; buf->len--;
-    result |= (byte & 127) << shift;
+    result |= (T) (byte & 127) << shift;
     if ((byte & 128) == 0) break;
     shift += 7;
     if (shift > sizeof(T) * 8) {
@@ -64,13 +68,156 @@ void unpack_bits(uint8_t *buf, uint64_t len, uint8_t bw, T *values,
 
   // the leftover bytes must be unpacked from a dummy buffer, into a
   // dummy buffer, because out input and/or output buffer is not long
-  // enough
+  // enough. These are at most one group, so they fit on the stack.
   if (num_values > 0) {
-    unique_ptr<uint8_t[]> ib(new uint8_t[input_group_size]);
-    unique_ptr<T[]> ob(new T[output_group_size]);
+    uint32_t ib[sizeof(T) * 8 * sizeof(T) * 8 / 32];
+    T ob[sizeof(T) * 8];
     int left_bytes = num_values * bw / 8 + ((bw * num_values) % 8 > 0);
-    memcpy(ib.get(), buf, left_bytes);
-    fastpforlib::fastunpack((uint32_t*) ib.get(), ob.get(), bw2);
-    memcpy(values, ob.get(), num_values * sizeof(T));
+    memcpy(ib, buf, left_bytes);
+    fastpforlib::fastunpack(ib, ob, bw2);
+    memcpy(values, ob, num_values * sizeof(T));
+  }
+}
+
+// The prefix sum of DELTA_BINARY_PACKED values:
+// values[i] = values[i - 1] + values[i] + min_delta, for i in [0, n),
+// so values[-1] must be the previous value. This is unsigned, so
+// overflow wraps around, as in the encoder. With SSE2 we add four
+// int32 or two int64 values at once, with in-register prefix sums.
+
+template <typename T>
+inline uint64_t delta_prefix_sum_sse2(T *values, uint64_t n, T min_delta) {
+  return 0;
+}
+
+#if defined(__SSE2__)
+
+inline uint64_t delta_prefix_sum_sse2(uint32_t *values, uint64_t n,
+                                      uint32_t min_delta) {
+  __m128i md = _mm_set1_epi32((int) min_delta);
+  __m128i carry = _mm_set1_epi32((int) values[-1]);
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (values + i));
+    x = _mm_add_epi32(x, md);
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, carry);
+    _mm_storeu_si128((__m128i *) (values + i), x);
+    carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  return i;
+}
+
+inline uint64_t delta_prefix_sum_sse2(uint64_t *values, uint64_t n,
+                                      uint64_t min_delta) {
+  __m128i md = _mm_set1_epi64x((long long) min_delta);
+  __m128i carry = _mm_set1_epi64x((long long) values[-1]);
+  uint64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (values + i));
+    x = _mm_add_epi64(x, md);
+    x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi64(x, carry);
+    _mm_storeu_si128((__m128i *) (values + i), x);
+    carry = _mm_unpackhi_epi64(x, x);
+  }
+  return i;
+}
+
+#endif
+
+template <typename T>
+void delta_prefix_sum(T *values, uint64_t n, T min_delta) {
+  uint64_t i = 0;
+#if defined(__SSE2__)
+  i = delta_prefix_sum_sse2(values, n, min_delta);
+#endif
+  for (; i < n; i++) {
+    values[i] = values[i - 1] + values[i] + min_delta;
+  }
+}
+
+// BYTE_STREAM_SPLIT: byte b of value j is at in[b * stride + j], where
+// stride is the number of values in the page. We decode the first n
+// values into out, n * N bytes. With SSE2 (always available on x86_64)
+// 16 values are transposed at once, the rest, and other value sizes,
+// are decoded one byte stream at a time.
+
+#if defined(__SSE2__)
+
+inline uint64_t bss_decode_sse2(const uint8_t *in, uint64_t n,
+                                uint64_t stride, uint8_t *out,
+                                std::integral_constant<int, 4>) {
+  uint64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m128i s0 = _mm_loadu_si128((const __m128i *) (in + j));
+    __m128i s1 = _mm_loadu_si128((const __m128i *) (in + stride + j));
+    __m128i s2 = _mm_loadu_si128((const __m128i *) (in + 2 * stride + j));
+    __m128i s3 = _mm_loadu_si128((const __m128i *) (in + 3 * stride + j));
+    __m128i t0 = _mm_unpacklo_epi8(s0, s1);
+    __m128i t1 = _mm_unpackhi_epi8(s0, s1);
+    __m128i t2 = _mm_unpacklo_epi8(s2, s3);
+    __m128i t3 = _mm_unpackhi_epi8(s2, s3);
+    __m128i *o = (__m128i *) (out + j * 4);
+    _mm_storeu_si128(o, _mm_unpacklo_epi16(t0, t2));
+    _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(t0, t2));
+    _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(t1, t3));
+    _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(t1, t3));
+  }
+  return j;
+}
+
+inline uint64_t bss_decode_sse2(const uint8_t *in, uint64_t n,
+                                uint64_t stride, uint8_t *out,
+                                std::integral_constant<int, 8>) {
+  uint64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m128i s[8], t[8], u[8];
+    for (int b = 0; b < 8; b++) {
+      s[b] = _mm_loadu_si128((const __m128i *) (in + b * stride + j));
+    }
+    // pairs of bytes: t[0], t[1] bytes 0-1, t[2], t[3] bytes 2-3, etc.
+    for (int b = 0; b < 8; b += 2) {
+      t[b] = _mm_unpacklo_epi8(s[b], s[b + 1]);
+      t[b + 1] = _mm_unpackhi_epi8(s[b], s[b + 1]);
+    }
+    // four bytes: u[0] - u[3] bytes 0-3, u[4] - u[7] bytes 4-7
+    for (int h = 0; h < 8; h += 4) {
+      u[h] = _mm_unpacklo_epi16(t[h], t[h + 2]);
+      u[h + 1] = _mm_unpackhi_epi16(t[h], t[h + 2]);
+      u[h + 2] = _mm_unpacklo_epi16(t[h + 1], t[h + 3]);
+      u[h + 3] = _mm_unpackhi_epi16(t[h + 1], t[h + 3]);
+    }
+    __m128i *o = (__m128i *) (out + j * 8);
+    for (int q = 0; q < 4; q++) {
+      _mm_storeu_si128(o + 2 * q, _mm_unpacklo_epi32(u[q], u[q + 4]));
+      _mm_storeu_si128(o + 2 * q + 1, _mm_unpackhi_epi32(u[q], u[q + 4]));
+    }
+  }
+  return j;
+}
+
+template <int N>
+inline uint64_t bss_decode_sse2(const uint8_t *in, uint64_t n,
+                                uint64_t stride, uint8_t *out,
+                                std::integral_constant<int, N>) {
+  return 0;
+}
+
+#endif
+
+template <int N>
+void bss_decode(const uint8_t *in, uint64_t n, uint64_t stride,
+                uint8_t *out) {
+  uint64_t j = 0;
+#if defined(__SSE2__)
+  j = bss_decode_sse2(in, n, stride, out, std::integral_constant<int, N>());
+#endif
+  for (int b = 0; b < N; b++) {
+    const uint8_t *src = in + b * stride;
+    for (uint64_t k = j; k < n; k++) {
+      out[k * N + b] = src[k];
+    }
   }
 }
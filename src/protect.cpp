@@ -92,3 +92,10 @@ SEXP wrapped_xlengthgets(void *data) {
     (struct safe_xlengthgets_data *) data;
   return Rf_xlengthgets(rdata->x, rdata->len);
 }
+
+SEXP wrapped_copymostattrib(void *data) {
+  struct safe_copymostattrib_data *rdata =
+    (struct safe_copymostattrib_data *) data;
+  Rf_copyMostAttrib(rdata->from, rdata->to);
+  return R_NilValue;
+}
@@ -52,6 +52,7 @@ SEXP wrapped_scalarlogical(void *data);
 SEXP wrapped_scalarstring(void *data);
 SEXP wrapped_setattrib(void *data);
 SEXP wrapped_xlengthgets(void *data);
+SEXP wrapped_copymostattrib(void *data);
 
 inline SEXP safe_allocvector_raw(R_xlen_t len, SEXP *uwt) {
   return R_UnwindProtect(wrapped_rawsxp, &len, throw_error, uwt, *uwt);
@@ -139,3 +140,13 @@ inline SEXP safe_xlengthgets(SEXP x, R_xlen_t len, SEXP *uwt) {
   struct safe_xlengthgets_data d = { x, len };
   return R_UnwindProtect(wrapped_xlengthgets, &d, throw_error, uwt, *uwt);
 }
+
+struct safe_copymostattrib_data {
+  SEXP from;
+  SEXP to;
+};
+
+inline void safe_copymostattrib(SEXP from, SEXP to, SEXP *uwt) {
+  struct safe_copymostattrib_data d = { from, to };
+  R_UnwindProtect(wrapped_copymostattrib, &d, throw_error, uwt, *uwt);
+}
@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <unordered_map>
 
 #include "lib/nanoparquet.h"
 #undef ERROR
 #include <Rdefines.h>
 #include "protect.h"
+#include "altrep.h"
 
 using namespace nanoparquet;
 using namespace std;
@@ -22,28 +25,453 @@ static int64_t impala_timestamp_to_nanoseconds(const Int96 &impala_timestamp) {
   return days_since_epoch * kNanosecondsInADay + nanoseconds;
 }
 
+static SEXP get_option(SEXP options, const char *name) {
+  SEXP nms = Rf_getAttrib(options, R_NamesSymbol);
+  if (TYPEOF(options) != VECSXP || Rf_isNull(nms)) {
+    return R_NilValue;
+  }
+  for (R_xlen_t i = 0; i < XLENGTH(options); i++) {
+    if (!strcmp(CHAR(STRING_ELT(nms, i)), name)) {
+      return VECTOR_ELT(options, i);
+    }
+  }
+  return R_NilValue;
+}
+
+static bool get_flag_option(SEXP options, const char *name, bool dflt) {
+  SEXP opt = get_option(options, name);
+  if (TYPEOF(opt) != LGLSXP || XLENGTH(opt) != 1 ||
+      LOGICAL(opt)[0] == NA_LOGICAL) {
+    return dflt;
+  }
+  return LOGICAL(opt)[0];
+}
+
+static double get_double_option(SEXP options, const char *name,
+                                double dflt) {
+  SEXP opt = get_option(options, name);
+  if (TYPEOF(opt) == INTSXP && XLENGTH(opt) == 1 &&
+      INTEGER(opt)[0] != NA_INTEGER) {
+    return INTEGER(opt)[0];
+  } else if (TYPEOF(opt) == REALSXP && XLENGTH(opt) == 1 &&
+             !ISNAN(REAL(opt)[0])) {
+    return REAL(opt)[0];
+  }
+  return dflt;
+}
+
+// number of physical units in a second for TIME and TIMESTAMP columns,
+// zero for other columns
+static double time_units_per_sec(parquet::SchemaElement *s_ele) {
+  if (s_ele->__isset.logicalType) {
+    auto &lt = s_ele->logicalType;
+    const parquet::TimeUnit *unit = nullptr;
+    if (lt.__isset.TIMESTAMP) unit = &lt.TIMESTAMP.unit;
+    if (lt.__isset.TIME) unit = &lt.TIME.unit;
+    if (unit) {
+      if (unit->__isset.MILLIS) return 1e3;
+      if (unit->__isset.MICROS) return 1e6;
+      if (unit->__isset.NANOS) return 1e9;
+    }
+  }
+  if (s_ele->__isset.converted_type) {
+    switch (s_ele->converted_type) {
+    case parquet::ConvertedType::TIMESTAMP_MILLIS:
+    case parquet::ConvertedType::TIME_MILLIS:
+      return 1e3;
+    case parquet::ConvertedType::TIMESTAMP_MICROS:
+    case parquet::ConvertedType::TIME_MICROS:
+      return 1e6;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+
+// The filter is a list of predicates, created by parse_filter() in R.
+// Each predicate is a list of the 1-based column index, the operator,
+// the values, whether the values are in seconds (POSIXct, difftime)
+// and whether %in% matches NA.
+
+static vector<Predicate> convert_filter(SEXP filtersxp, ParquetFile &f) {
+  vector<Predicate> filter;
+  if (Rf_isNull(filtersxp)) return filter;
+  static const char *op_names[] = {
+    "==", "!=", "<", "<=", ">", ">=", "%in%", "is.na", "!is.na"
+  };
+  static const FilterOp ops[] = {
+    FilterOp::EQ, FilterOp::NE, FilterOp::LT, FilterOp::LE, FilterOp::GT,
+    FilterOp::GE, FilterOp::IN, FilterOp::IS_NA, FilterOp::NOT_NA
+  };
+
+  for (R_xlen_t i = 0; i < XLENGTH(filtersxp); i++) {
+    SEXP psxp = VECTOR_ELT(filtersxp, i);
+    int col = INTEGER(VECTOR_ELT(psxp, 0))[0];
+    const char *op = CHAR(STRING_ELT(VECTOR_ELT(psxp, 1), 0));
+    SEXP values = VECTOR_ELT(psxp, 2);
+    bool secs = LOGICAL(VECTOR_ELT(psxp, 3))[0];
+    bool match_na = LOGICAL(VECTOR_ELT(psxp, 4))[0];
+    bool match_nan = LOGICAL(VECTOR_ELT(psxp, 5))[0];
+    if (col < 1 || (uint64_t) col > f.columns.size()) {
+      throw runtime_error("nanoparquet_read: invalid column index in `filter`");
+    }
+
+    Predicate pred;
+    pred.column = col - 1;
+    ParquetColumn *pcol = f.columns[pred.column].get();
+    pred.type = pcol->type;
+    pred.match_na = match_na;
+    pred.match_nan = match_nan;
+    size_t op_idx = 0;
+    while (op_idx < sizeof(ops) / sizeof(ops[0]) &&
+           strcmp(op, op_names[op_idx])) {
+      op_idx++;
+    }
+    if (op_idx == sizeof(ops) / sizeof(ops[0])) {
+      throw runtime_error(string("nanoparquet_read: unknown filter operator ") + op);
+    }
+    pred.op = ops[op_idx];
+
+    auto s_ele = pcol->schema_element;
+    bool is_unsigned =
+      (s_ele->__isset.logicalType && s_ele->logicalType.__isset.INTEGER &&
+       !s_ele->logicalType.INTEGER.isSigned) ||
+      (s_ele->__isset.converted_type &&
+       (s_ele->converted_type == parquet::ConvertedType::UINT_8 ||
+        s_ele->converted_type == parquet::ConvertedType::UINT_16 ||
+        s_ele->converted_type == parquet::ConvertedType::UINT_32 ||
+        s_ele->converted_type == parquet::ConvertedType::UINT_64));
+    bool is_decimal =
+      (s_ele->__isset.logicalType && s_ele->logicalType.__isset.DECIMAL) ||
+      (s_ele->__isset.converted_type &&
+       s_ele->converted_type == parquet::ConvertedType::DECIMAL);
+    if (pred.type == parquet::Type::INT96 ||
+        pred.type == parquet::Type::FIXED_LEN_BYTE_ARRAY ||
+        is_unsigned || is_decimal) {
+      throw runtime_error(
+        "Cannot filter on column `" + pcol->name + "`, filtering on " +
+        "INT96, FIXED_LEN_BYTE_ARRAY, unsigned and decimal columns " +
+        "is not supported");
+    }
+
+    if (pred.op == FilterOp::IS_NA || pred.op == FilterOp::NOT_NA) {
+      // no values
+    } else if (pred.type == parquet::Type::BYTE_ARRAY) {
+      if (TYPEOF(values) != STRSXP) {
+        throw runtime_error(
+          "Column `" + pcol->name + "` can only be compared to strings " +
+          "in `filter`");
+      }
+      for (R_xlen_t j = 0; j < XLENGTH(values); j++) {
+        SEXP v = STRING_ELT(values, j);
+        pred.str_values.push_back(string(CHAR(v), LENGTH(v)));
+      }
+    } else {
+      if (TYPEOF(values) != REALSXP) {
+        throw runtime_error(
+          "Column `" + pcol->name + "` can only be compared to numbers " +
+          "in `filter`");
+      }
+      double mult = 1;
+      if (secs) {
+        mult = time_units_per_sec(s_ele);
+        if (mult == 0) {
+          throw runtime_error(
+            "Column `" + pcol->name + "` is not a time or timestamp, " +
+            "cannot compare it to a time in `filter`");
+        }
+      }
+      for (R_xlen_t j = 0; j < XLENGTH(values); j++) {
+        pred.num_values.push_back(REAL(values)[j] * mult);
+      }
+    }
+    if ((pred.op != FilterOp::IN && pred.op != FilterOp::IS_NA &&
+         pred.op != FilterOp::NOT_NA) &&
+        pred.num_values.size() + pred.str_values.size() != 1) {
+      throw runtime_error("nanoparquet_read: need exactly one value for comparison in `filter`");
+    }
+    std::sort(pred.num_values.begin(), pred.num_values.end());
+    std::sort(pred.str_values.begin(), pred.str_values.end());
+    filter.push_back(pred);
+  }
+
+  return filter;
+}
+
+// Levels of a string column that we read as a factor. The dictionary
+// of each column chunk is mapped to the levels once, into a translation
+// table, and the rows of the dictionary encoded pages are mapped
+// through that, so we never create the strings of the rows.
+
+struct FactorLevels {
+  vector<string> levels;
+  unordered_map<string, int> index;
+  vector<int> dict_map;
+
+  // 1-based level of a string, adds a new level if needed
+  int get(const char *str, uint32_t len) {
+    string key(str, len);
+    auto it = index.find(key);
+    if (it != index.end()) return it->second;
+    levels.push_back(key);
+    index[key] = levels.size();
+    return levels.size();
+  }
+};
+
+// Formats the 16 bytes of a UUID, `out` must have room for 37 bytes
+
+static void format_uuid(const char *bytes, char *out) {
+  const unsigned char *s = (const unsigned char*) bytes;
+  snprintf(
+    out, 37,
+    "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+    s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8], s[9],
+    s[10], s[11], s[12], s[13], s[14], s[15]
+  );
+}
+
+// Does the column have dictionary encoded pages in any row group?
+
+static bool has_dictionary(ParquetFile &f, uint64_t col_id) {
+  for (auto &rg : f.file_meta_data.row_groups) {
+    auto &md = rg.columns[col_id].meta_data;
+    if (md.__isset.dictionary_page_offset) return true;
+    for (auto enc : md.encodings) {
+      if (enc == parquet::Encoding::PLAIN_DICTIONARY ||
+          enc == parquet::Encoding::RLE_DICTIONARY) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Does the metadata show that the column has no missing values in the
+// row groups we read? Doubles might still have NaN values, which R
+// also considers missing, so we cannot tell for these.
+
+static bool no_missing_values(ParquetFile &f, uint64_t col_id,
+                              const ScanState &s) {
+  if (f.columns[col_id]->type == parquet::Type::DOUBLE ||
+      f.columns[col_id]->type == parquet::Type::FLOAT) {
+    return false;
+  }
+  auto &s_ele = f.columns[col_id]->schema_element;
+  if (s_ele->__isset.repetition_type &&
+      s_ele->repetition_type == parquet::FieldRepetitionType::REQUIRED) {
+    return true;
+  }
+  for (auto &r : s.row_groups) {
+    auto &md = f.file_meta_data.row_groups[r.row_group].columns[col_id].meta_data;
+    if (!md.__isset.statistics || !md.statistics.__isset.null_count ||
+        md.statistics.null_count != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The options for reading a lazy column, the same, without `lazy` and
+// `compact_dict`, the lazy column is materialized as a regular vector.
+
+static SEXP eager_options(SEXP options, SEXP *uwt) {
+  R_xlen_t n = Rf_xlength(options);
+  SEXP nms = Rf_getAttrib(options, R_NamesSymbol);
+  SEXP res = PROTECT(safe_allocvector_vec(n, uwt));
+  for (R_xlen_t i = 0; i < n; i++) {
+    const char *nm = CHAR(STRING_ELT(nms, i));
+    if (!strcmp(nm, "lazy") || !strcmp(nm, "compact_dict")) {
+      SET_VECTOR_ELT(res, i, safe_scalarlogical(0, uwt));
+    } else {
+      SET_VECTOR_ELT(res, i, VECTOR_ELT(options, i));
+    }
+  }
+  safe_setattrib(res, R_NamesSymbol, nms, uwt);
+  UNPROTECT(1);
+  return res;
+}
+
+static SEXP safe_allocvector_like(SEXP x, R_xlen_t len, SEXP *uwt) {
+  switch (TYPEOF(x)) {
+  case INTSXP:
+    return safe_allocvector_int(len, uwt);
+  case REALSXP:
+    return safe_allocvector_real(len, uwt);
+  case LGLSXP:
+    return safe_allocvector_lgl(len, uwt);
+  case STRSXP:
+    return safe_allocvector_str(len, uwt);
+  default:
+    return safe_allocvector_vec(len, uwt);
+  }
+}
+
+// Is row in one of the (sorted) ranges? The rows are queried in
+// increasing order, `pos` remembers where we are in `ranges`.
+
+static bool in_row_ranges(const vector<RowRange> &ranges, uint64_t row,
+                          size_t &pos) {
+  while (pos < ranges.size() && ranges[pos].to <= row) {
+    pos++;
+  }
+  return pos < ranges.size() && ranges[pos].from <= row;
+}
+
+// The bytes of a BYTE_ARRAY or FIXED_LEN_BYTE_ARRAY value. We keep the
+// dictionary indices of these columns, so the rows of the dictionary
+// encoded pages are only in the dictionary.
+
+static pair<uint32_t, const char *> str_value(const ResultColumn &col,
+                                              uint64_t row_idx,
+                                              size_t &dict_range) {
+  if (col.dict && in_row_ranges(col.dict_rows, row_idx, dict_range)) {
+    auto &val = col.dict->dict[((const uint32_t *) col.dict_offsets.ptr)[row_idx]];
+    return make_pair(val.first, (const char *) val.second);
+  }
+  return make_pair(col.str_len(row_idx), col.str_ptr(row_idx));
+}
+
+// A dictionary encoded column that we return as a compact ALTREP
+// vector: the distinct values, and a 1-based index for each row, 0 is
+// NA. The values are keyed by their bytes, as an int, a double, or a
+// string. dict_map maps the current dictionary to the values, it is
+// filled when a dictionary entry first occurs, 0 means not seen yet.
+
+struct CompactColumn {
+  vector<string> values;
+  unordered_map<string, uint32_t> index;
+  vector<uint32_t> rows;
+  vector<uint32_t> dict_map;
+  bool has_na = false;
+
+  CompactColumn(uint64_t nrows) : rows(nrows) { }
+
+  uint32_t get(const char *bytes, uint32_t len) {
+    string key(bytes, len);
+    auto it = index.find(key);
+    if (it != index.end()) return it->second;
+    values.push_back(key);
+    index[key] = values.size();
+    return values.size();
+  }
+
+  // `value(row_idx)` returns the index of the value of a row, it is only
+  // called for the rows outside of the dictionary encoded pages, and
+  // for the first row of each dictionary entry
+  template <class F>
+  void add(uint64_t dest_idx, const ResultColumn &col, uint64_t row_idx,
+           size_t &dict_range, F value) {
+    if (!col.is_defined(row_idx)) {
+      rows[dest_idx] = 0;
+      has_na = true;
+    } else if (in_row_ranges(col.dict_rows, row_idx, dict_range)) {
+      uint32_t off = ((const uint32_t *) col.dict_offsets.ptr)[row_idx];
+      if (off >= dict_map.size()) dict_map.resize(off + 1, 0);
+      if (dict_map[off] == 0) dict_map[off] = value(row_idx);
+      rows[dest_idx] = dict_map[off];
+    } else {
+      rows[dest_idx] = value(row_idx);
+    }
+  }
+};
+
 extern "C" {
 
-SEXP nanoparquet_read(SEXP filesxp) {
+SEXP nanoparquet_read(SEXP filesxp, SEXP colsel, SEXP rowgroups,
+                      SEXP skipsxp, SEXP nmaxsxp, SEXP filtersxp,
+                      SEXP factorsxp, SEXP eagersxp, SEXP options) {
   if (TYPEOF(filesxp) != STRSXP || LENGTH(filesxp) != 1) {
     Rf_error("nanoparquet_read: Need single filename parameter");
   }
+  if (!Rf_isNull(colsel) && TYPEOF(colsel) != INTSXP) {
+    Rf_error("nanoparquet_read: `col_select` must be NULL or an integer vector");
+  }
+  if (!Rf_isNull(rowgroups) && TYPEOF(rowgroups) != INTSXP) {
+    Rf_error("nanoparquet_read: `row_groups` must be NULL or an integer vector");
+  }
+  if (!Rf_isNull(factorsxp) && TYPEOF(factorsxp) != INTSXP) {
+    Rf_error("nanoparquet_read: `factors` must be NULL or an integer vector");
+  }
+  if (!Rf_isNull(eagersxp) && TYPEOF(eagersxp) != INTSXP) {
+    Rf_error("nanoparquet_read: `eager` must be NULL or an integer vector");
+  }
+  if (TYPEOF(skipsxp) != REALSXP || LENGTH(skipsxp) != 1 ||
+      TYPEOF(nmaxsxp) != REALSXP || LENGTH(nmaxsxp) != 1) {
+    Rf_error("nanoparquet_read: `skip` and `n_max` must be double scalars");
+  }
 
   SEXP uwtoken = PROTECT(R_MakeUnwindCont());
   R_API_START();
 
   // parse the query and transform it into a set of statements
   char *fname = (char *)CHAR(STRING_ELT(filesxp, 0));
+  bool use_mmap = get_flag_option(options, "use_mmap", false);
 
-  ParquetFile f(fname);
+  ParquetFile f(fname, use_mmap);
+  double read_gap = get_double_option(options, "read_gap", f.read_gap);
+  f.read_gap = read_gap > 0 ? (uint64_t) read_gap : 0;
+  double prefetch = get_double_option(options, "prefetch", f.prefetch);
+  f.prefetch = prefetch > 0 ? (uint64_t) prefetch : 0;
+  double num_threads = get_double_option(options, "num_threads", 1);
+  f.num_threads = num_threads > 1 ? (uint64_t) num_threads : 1;
+  bool read_factors = get_flag_option(options, "read_factors", false);
+  bool lazy = get_flag_option(options, "lazy", false);
+  bool compact_dict = get_flag_option(options, "compact_dict", false);
 
   // check if we are able to read this file
   f.read_checks();
 
+  // columns to read, all of them by default. These are 1-based in R.
+  vector<uint64_t> col_select;
+  if (Rf_isNull(colsel)) {
+    for (uint64_t i = 0; i < f.columns.size(); i++) {
+      col_select.push_back(i);
+    }
+  } else {
+    for (R_xlen_t i = 0; i < XLENGTH(colsel); i++) {
+      int ci = INTEGER(colsel)[i];
+      if (ci == NA_INTEGER || ci < 1 || (uint64_t) ci > f.columns.size()) {
+        throw runtime_error("nanoparquet_read: invalid column index in `col_select`");
+      }
+      col_select.push_back(ci - 1);
+    }
+  }
+
+  // row groups to read, all of them by default, these are 1-based, too
+  vector<uint64_t> row_groups;
+  if (Rf_isNull(rowgroups)) {
+    for (uint64_t i = 0; i < f.file_meta_data.row_groups.size(); i++) {
+      row_groups.push_back(i);
+    }
+  } else {
+    for (R_xlen_t i = 0; i < XLENGTH(rowgroups); i++) {
+      int rg = INTEGER(rowgroups)[i];
+      if (rg == NA_INTEGER || rg < 1) {
+        throw runtime_error("nanoparquet_read: invalid row group index in `row_groups`");
+      }
+      row_groups.push_back(rg - 1);
+    }
+  }
+
+  f.filter = convert_filter(filtersxp, f);
+
+  // n_max may be Inf
+  double skip = REAL(skipsxp)[0];
+  double n_max = REAL(nmaxsxp)[0];
+  ScanState s;
+  f.initialize_scan(
+    s,
+    row_groups,
+    skip < f.nrow ? (uint64_t) skip : f.nrow,
+    n_max < f.nrow ? (uint64_t) n_max : f.nrow
+  );
+
   // allocate vectors
 
-  auto ncols = f.columns.size();
-  auto nrows = f.nrow;
+  auto ncols = col_select.size();
+  auto nrows = s.nrow;
 
   SEXP retlist = PROTECT(safe_allocvector_vec(ncols, &uwtoken));
   SEXP names = PROTECT(safe_allocvector_str(ncols, &uwtoken));
@@ -60,22 +488,66 @@ SEXP nanoparquet_read(SEXP filesxp) {
     time_factors[i] = 1;
   }
 
+  // string columns that are factors according to the Arrow metadata,
+  // or dictionary encoded ones, if read_factors is set
+  vector<unique_ptr<FactorLevels>> factors(ncols);
   for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+    uint64_t col_id = col_select[col_idx];
+    auto type = f.columns[col_id]->type;
+    if (type != parquet::Type::BYTE_ARRAY &&
+        type != parquet::Type::FIXED_LEN_BYTE_ARRAY) {
+      continue;
+    }
+    bool fct = read_factors && has_dictionary(f, col_id);
+    for (R_xlen_t i = 0; !fct && i < Rf_xlength(factorsxp); i++) {
+      fct = INTEGER(factorsxp)[i] == (int) col_id + 1;
+    }
+    if (fct) factors[col_idx].reset(new FactorLevels());
+  }
+
+  // dictionary encoded columns that we return as compact vectors
+  vector<unique_ptr<CompactColumn>> compact(ncols);
+
+  // the columns that we read now, the rest are lazy
+  vector<size_t> scan_idx;
+  vector<uint64_t> scan_select;
+  SEXP lazy_options = R_NilValue;
+  // protects lazy_options
+  SEXP lazy_prot = PROTECT(safe_allocvector_vec(1, &uwtoken));
+
+  for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+    ParquetColumn *pcol = f.columns[col_select[col_idx]].get();
     SEXP varname =
-        PROTECT(safe_mkchar_utf8(f.columns[col_idx]->name.c_str(), &uwtoken));
+        PROTECT(safe_mkchar_utf8(pcol->name.c_str(), &uwtoken));
     SET_STRING_ELT(names, col_idx, varname);
     UNPROTECT(1); // varname
 
-    INTEGER(types)[col_idx] = f.columns[col_idx]->type;
+    INTEGER(types)[col_idx] = pcol->type;
+
+    // lazy columns are not read now, we only need their type and
+    // attributes here. The R code converts the `eager` columns (e.g.
+    // Arrow durations) right away, so there is no point in those.
+    bool eager_col = false;
+    for (R_xlen_t i = 0; !eager_col && i < Rf_xlength(eagersxp); i++) {
+      eager_col = INTEGER(eagersxp)[i] == (int) col_select[col_idx] + 1;
+    }
+    bool lazy_col = lazy && f.filter.empty() && !factors[col_idx] &&
+      !eager_col;
+    // compact columns are created after reading the data
+    bool compact_col = compact_dict && !lazy_col && !factors[col_idx] &&
+      pcol->type != parquet::Type::BOOLEAN &&
+      pcol->type != parquet::Type::INT96 &&
+      has_dictionary(f, col_select[col_idx]);
+    R_xlen_t alloc_rows = lazy_col || compact_col ? 0 : nrows;
 
     SEXP varvalue = NULL;
-    switch (f.columns[col_idx]->type) {
+    switch (pcol->type) {
     case parquet::Type::BOOLEAN:
-      varvalue = PROTECT(safe_allocvector_lgl(nrows, &uwtoken));
+      varvalue = PROTECT(safe_allocvector_lgl(alloc_rows, &uwtoken));
       break;
     case parquet::Type::INT32: {
-      varvalue = PROTECT(safe_allocvector_int(nrows, &uwtoken));
-      auto &s_ele = f.columns[col_idx]->schema_element;
+      varvalue = PROTECT(safe_allocvector_int(alloc_rows, &uwtoken));
+      auto &s_ele = pcol->schema_element;
       if ((s_ele->__isset.logicalType &&
            s_ele->logicalType.__isset.DATE) ||
           (s_ele->__isset.converted_type &&
@@ -101,8 +573,8 @@ SEXP nanoparquet_read(SEXP filesxp) {
     case parquet::Type::INT64:
     case parquet::Type::DOUBLE:
     case parquet::Type::FLOAT: {
-      varvalue = PROTECT(safe_allocvector_real(nrows, &uwtoken));
-      auto &s_ele = f.columns[col_idx]->schema_element;
+      varvalue = PROTECT(safe_allocvector_real(alloc_rows, &uwtoken));
+      auto &s_ele = pcol->schema_element;
       if ((s_ele->__isset.logicalType &&
            s_ele->logicalType.__isset.TIMESTAMP &&
            (s_ele->logicalType.TIMESTAMP.unit.__isset.MILLIS ||
@@ -165,7 +637,7 @@ SEXP nanoparquet_read(SEXP filesxp) {
       break;
     }
     case parquet::Type::INT96: {
-      varvalue = PROTECT(safe_allocvector_real(nrows, &uwtoken));
+      varvalue = PROTECT(safe_allocvector_real(alloc_rows, &uwtoken));
       SEXP cl = PROTECT(safe_allocvector_str(2, &uwtoken));
       SET_STRING_ELT(cl, 0, PROTECT(safe_mkchar("POSIXct", &uwtoken)));
       SET_STRING_ELT(cl, 1, PROTECT(safe_mkchar("POSIXt", &uwtoken)));
@@ -177,7 +649,7 @@ SEXP nanoparquet_read(SEXP filesxp) {
     }
     case parquet::Type::BYTE_ARRAY:
     case parquet::Type::FIXED_LEN_BYTE_ARRAY: { // oof
-      auto &s_ele = f.columns[col_idx]->schema_element;
+      auto &s_ele = pcol->schema_element;
       // STRIGN, ENUM, UUID, UTF8 are read as strings
       if ((s_ele->__isset.logicalType &&
            (s_ele->logicalType.__isset.STRING ||
@@ -185,83 +657,242 @@ SEXP nanoparquet_read(SEXP filesxp) {
             s_ele->logicalType.__isset.UUID)) ||
           (s_ele->__isset.converted_type &&
            s_ele->converted_type == parquet::ConvertedType::UTF8)) {
-        varvalue = PROTECT(safe_allocvector_str(nrows, &uwtoken));
+        if (factors[col_idx] && !(s_ele->__isset.logicalType &&
+                                  s_ele->logicalType.__isset.UUID)) {
+          varvalue = PROTECT(safe_allocvector_int(alloc_rows, &uwtoken));
+          SET_CLASS(varvalue, safe_mkstring("factor", &uwtoken));
+        } else {
+          factors[col_idx].reset();
+          varvalue = PROTECT(safe_allocvector_str(alloc_rows, &uwtoken));
+        }
       } else if (s_ele->__isset.converted_type &&
                  s_ele->converted_type == parquet::ConvertedType::DECIMAL) {
         // DECIMAL converted type as REAL, for now
-        varvalue = PROTECT(safe_allocvector_real(nrows, &uwtoken));
+        factors[col_idx].reset();
+        varvalue = PROTECT(safe_allocvector_real(alloc_rows, &uwtoken));
       } else {
         // list of RAW vectors
-        varvalue = PROTECT(safe_allocvector_vec(nrows, &uwtoken));
+        factors[col_idx].reset();
+        varvalue = PROTECT(safe_allocvector_vec(alloc_rows, &uwtoken));
       }
       break;
     }
     default:
-      auto it = parquet::_Type_VALUES_TO_NAMES.find(
-          f.columns[col_idx]->type);
+      auto it = parquet::_Type_VALUES_TO_NAMES.find(pcol->type);
       string msg = string("nanoparquet_read: Unknown column type ") +
         it->second + " @ " __FILE__ ":" STR(__LINE__) " (" + __func__ + ")";
       throw msg;
     }
     SET_VECTOR_ELT(retlist, col_idx, varvalue);
     UNPROTECT(1); /* varvalue */
+
+    // these are converted in R, which would read them right away.
+    // UUIDs and DECIMALs are converted from the bytes of each row, so
+    // we don't make them compact.
+    auto &s_ele = pcol->schema_element;
+    bool bytes_col = pcol->type == parquet::Type::BYTE_ARRAY ||
+      pcol->type == parquet::Type::FIXED_LEN_BYTE_ARRAY;
+    bool uuid_col = s_ele->__isset.logicalType &&
+      s_ele->logicalType.__isset.UUID;
+    if ((lazy_col || compact_col) &&
+        (TYPEOF(varvalue) == VECSXP || Rf_inherits(varvalue, "hms") ||
+         Rf_inherits(varvalue, "POSIXct") ||
+         (compact_col && bytes_col &&
+          (TYPEOF(varvalue) != STRSXP || uuid_col)))) {
+      SEXP full = PROTECT(safe_allocvector_like(varvalue, nrows, &uwtoken));
+      safe_copymostattrib(varvalue, full, &uwtoken);
+      SET_VECTOR_ELT(retlist, col_idx, full);
+      UNPROTECT(1);
+      lazy_col = compact_col = false;
+    }
+    if (compact_col) {
+      compact[col_idx].reset(new CompactColumn(nrows));
+    }
+
+    if (lazy_col) {
+      if (Rf_isNull(lazy_options)) {
+        lazy_options = eager_options(options, &uwtoken);
+        SET_VECTOR_ELT(lazy_prot, 0, lazy_options);
+      }
+      SEXP info = PROTECT(safe_allocvector_vec(8, &uwtoken));
+      SET_VECTOR_ELT(info, 0, filesxp);
+      SET_VECTOR_ELT(info, 1, safe_scalarinteger(col_select[col_idx] + 1, &uwtoken));
+      SET_VECTOR_ELT(info, 2, rowgroups);
+      SET_VECTOR_ELT(info, 3, skipsxp);
+      SET_VECTOR_ELT(info, 4, nmaxsxp);
+      SET_VECTOR_ELT(info, 5, lazy_options);
+      SET_VECTOR_ELT(info, 6, safe_scalarreal(nrows, &uwtoken));
+      SET_VECTOR_ELT(
+        info, 7,
+        safe_scalarlogical(no_missing_values(f, col_select[col_idx], s), &uwtoken)
+      );
+      SET_VECTOR_ELT(retlist, col_idx, safe_lazy_column(varvalue, info, &uwtoken));
+      UNPROTECT(1);
+      continue;
+    }
+    scan_idx.push_back(col_idx);
+    scan_select.push_back(col_select[col_idx]);
+  }
+
+  // at this point retlist, dicts, types, lazy_prot, uwtoken are the only
+  // protected SEXPs
+
+  // INT32, BOOLEAN and DOUBLE columns are decoded directly into the
+  // R vectors, for the row groups that are read completely, and if
+  // there is no filter. We only copy the rest.
+  f.sinks.assign(scan_idx.size(), ColumnSink{ nullptr, NA_INTEGER, NA_REAL });
+  for (size_t ri = 0; ri < scan_idx.size(); ri++) {
+    if (compact[scan_idx[ri]]) continue;
+    SEXP dest = VECTOR_ELT(retlist, scan_idx[ri]);
+    switch (f.columns[scan_select[ri]]->type) {
+    case parquet::Type::BOOLEAN:
+      f.sinks[ri].ptr = LOGICAL(dest);
+      break;
+    case parquet::Type::INT32:
+      f.sinks[ri].ptr = INTEGER(dest);
+      break;
+    case parquet::Type::DOUBLE:
+      f.sinks[ri].ptr = REAL(dest);
+      break;
+    default:
+      break;
+    }
   }
 
-  // at this point retlist, dictm uwtoken, are the only protected SEXPs
+  // for dictionary encoded strings we create a CHARSXP for each
+  // dictionary entry only, not for each row, and the rows of these
+  // pages are not copied, see str_value(). Compact columns look up
+  // each dictionary entry once.
+  f.keep_dict_offsets.assign(f.columns.size(), false);
+  for (size_t ri = 0; ri < scan_idx.size(); ri++) {
+    auto type = f.columns[scan_select[ri]]->type;
+    if (compact[scan_idx[ri]] || type == parquet::Type::BYTE_ARRAY ||
+        type == parquet::Type::FIXED_LEN_BYTE_ARRAY) {
+      f.keep_dict_offsets[scan_select[ri]] = true;
+    }
+  }
 
   ResultChunk rc;
-  ScanState s;
 
-  f.initialize_result(rc);
+  f.initialize_result(rc, scan_select);
   uint64_t dest_offset = 0;
 
-  while (f.scan(s, rc)) {
-    for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+  while (!scan_idx.empty() && f.scan(s, rc)) {
+    for (size_t ri = 0; ri < scan_idx.size(); ri++) {
+      size_t col_idx = scan_idx[ri];
       int time_factor = time_factors[col_idx];
-      auto &col = rc.cols[col_idx];
+      auto &col = rc.cols[ri];
       SEXP dest = VECTOR_ELT(retlist, col_idx);
       // if it is a string with a dictionary, then store the dictionary
-      // so we can recover missing factor levels.
+      // so we can recover missing factor levels. We also use it for the
+      // rows of the dictionary encoded pages.
+      SEXP dict_strings = R_NilValue;
+      FactorLevels *fct = factors[col_idx].get();
+      CompactColumn *cmp = compact[col_idx].get();
+      if (cmp) {
+        cmp->dict_map.clear();
+        size_t dict_range = 0, str_range = 0;
+        uint64_t nsel = rc.filtered ? rc.selected.size() : rc.row_to - rc.row_from;
+        for (uint64_t sel_idx = 0; sel_idx < nsel; sel_idx++) {
+          uint64_t row_idx = rc.filtered ? rc.selected[sel_idx] : rc.row_from + sel_idx;
+          cmp->add(
+            dest_offset + sel_idx, col, row_idx, dict_range,
+            [&](uint64_t i) -> uint32_t {
+              switch (col.col->type) {
+              case parquet::Type::INT32:
+                return cmp->get(col.data.ptr + i * sizeof(int32_t), sizeof(int32_t));
+              case parquet::Type::INT64: {
+                double val = (double) ((int64_t *) col.data.ptr)[i] / time_factor;
+                return cmp->get((const char *) &val, sizeof(double));
+              }
+              case parquet::Type::FLOAT: {
+                double val = ((float *) col.data.ptr)[i];
+                return cmp->get((const char *) &val, sizeof(double));
+              }
+              case parquet::Type::DOUBLE:
+                return cmp->get(col.data.ptr + i * sizeof(double), sizeof(double));
+              default: {
+                auto val = str_value(col, i, str_range);
+                return cmp->get(val.second, val.first);
+              }
+              }
+            }
+          );
+        }
+        continue;
+      }
+      if (col.dict && fct) {
+        auto &strings = col.dict->dict;
+        fct->dict_map.resize(strings.size());
+        for (size_t i = 0; i < strings.size(); i++) {
+          fct->dict_map[i] = fct->get(strings[i].second, strings[i].first);
+        }
+      } else if (fct) {
+        fct->dict_map.clear();
+      }
       if (col.dict && TYPEOF(dest) == STRSXP) {
-        auto strings = col.dict->dict;
+        auto &strings = col.dict->dict;
+        auto &s_ele = col.col->schema_element;
+        // UUIDs are raw bytes in the dictionary, the strings are not
+        // terminated, they point into the page
+        bool uuid = s_ele->__isset.logicalType &&
+          s_ele->logicalType.__isset.UUID;
         SEXP rd = PROTECT(safe_allocvector_str(strings.size(), &uwtoken));
         for (auto i = 0; i < strings.size(); i++) {
-          SET_STRING_ELT(rd, i, safe_mkchar_utf8(strings[i].second, &uwtoken));
+          if (uuid && strings[i].first == 16) {
+            char str[37];
+            format_uuid(strings[i].second, str);
+            SET_STRING_ELT(rd, i, safe_mkchar_len_utf8(str, 36, &uwtoken));
+          } else {
+            SET_STRING_ELT(
+              rd, i,
+              safe_mkchar_len_utf8(strings[i].second, strings[i].first, &uwtoken)
+            );
+          }
         }
         SET_VECTOR_ELT(dicts, col_idx, rd);
         UNPROTECT(1);
-        col.dict.reset();
+        if (!uuid) dict_strings = rd;
       }
+      const uint32_t *dict_offsets = (const uint32_t *) col.dict_offsets.ptr;
+      size_t dict_range = 0;
+      if (col.sunk) continue;
 
-      for (uint64_t row_idx = 0; row_idx < rc.nrows; row_idx++) {
-        if (!col.defined.ptr[row_idx]) {
+      uint64_t nsel = rc.filtered ? rc.selected.size() : rc.row_to - rc.row_from;
+      for (uint64_t sel_idx = 0; sel_idx < nsel; sel_idx++) {
+        uint64_t row_idx = rc.filtered ? rc.selected[sel_idx] : rc.row_from + sel_idx;
+        uint64_t dest_idx = dest_offset + sel_idx;
+        if (!col.is_defined(row_idx)) {
 
           // NULLs
-          switch (f.columns[col_idx]->type) {
+          switch (col.col->type) {
           case parquet::Type::BOOLEAN:
-            LOGICAL_POINTER(dest)[row_idx + dest_offset] = NA_LOGICAL;
+            LOGICAL_POINTER(dest)[dest_idx] = NA_LOGICAL;
             break;
           case parquet::Type::INT32:
-            INTEGER_POINTER(dest)[row_idx + dest_offset] = NA_INTEGER;
+            INTEGER_POINTER(dest)[dest_idx] = NA_INTEGER;
             break;
           case parquet::Type::INT64:
           case parquet::Type::DOUBLE:
           case parquet::Type::FLOAT:
           case parquet::Type::INT96:
-            NUMERIC_POINTER(dest)[row_idx + dest_offset] = NA_REAL;
+            NUMERIC_POINTER(dest)[dest_idx] = NA_REAL;
             break;
           case parquet::Type::FIXED_LEN_BYTE_ARRAY:
           case parquet::Type::BYTE_ARRAY: {
             switch(TYPEOF(dest)) {
             case REALSXP:
-              NUMERIC_POINTER(dest)[row_idx + dest_offset] = NA_REAL;
+              NUMERIC_POINTER(dest)[dest_idx] = NA_REAL;
               break;
             case STRSXP:
-              SET_STRING_ELT(dest, row_idx + dest_offset, NA_STRING);
+              SET_STRING_ELT(dest, dest_idx, NA_STRING);
+              break;
+            case INTSXP:
+              INTEGER(dest)[dest_idx] = NA_INTEGER;
               break;
             case VECSXP:
               // NULL already, nothing to do?
-              SET_VECTOR_ELT(dest, row_idx + dest_offset, R_NilValue);
+              SET_VECTOR_ELT(dest, dest_idx, R_NilValue);
               break;
             default:
               string msg = string("nanoparquet_read: internal error, unexpected R type") +
@@ -272,7 +903,7 @@ SEXP nanoparquet_read(SEXP filesxp) {
           }
           default: {
             auto it = parquet::_Type_VALUES_TO_NAMES.find(
-                f.columns[col_idx]->type);
+                col.col->type);
             string msg = string("nanoparquet_read: Unknown column type ") +
               it->second + " @ " __FILE__ ":" STR(__LINE__) " (" +
               __func__ + ")";
@@ -282,86 +913,94 @@ SEXP nanoparquet_read(SEXP filesxp) {
           continue;
         }
 
-        switch (f.columns[col_idx]->type) {
+        switch (col.col->type) {
         case parquet::Type::BOOLEAN:
           LOGICAL_POINTER(dest)
-          [row_idx + dest_offset] = ((bool *)col.data.ptr)[row_idx];
+          [dest_idx] = ((bool *)col.data.ptr)[row_idx];
           break;
         case parquet::Type::INT32:
           INTEGER_POINTER(dest)
-          [row_idx + dest_offset] = ((int32_t *)col.data.ptr)[row_idx];
+          [dest_idx] = ((int32_t *)col.data.ptr)[row_idx];
           break;
         case parquet::Type::INT64:
           NUMERIC_POINTER(dest)
-          [row_idx + dest_offset] =
+          [dest_idx] =
               (double)((int64_t *)col.data.ptr)[row_idx] / time_factor;
         break;
         case parquet::Type::DOUBLE:
           NUMERIC_POINTER(dest)
-          [row_idx + dest_offset] = ((double *)col.data.ptr)[row_idx];
+          [dest_idx] = ((double *)col.data.ptr)[row_idx];
         break;
         case parquet::Type::FLOAT:
           NUMERIC_POINTER(dest)
-          [row_idx + dest_offset] = (double)((float *)col.data.ptr)[row_idx];
+          [dest_idx] = (double)((float *)col.data.ptr)[row_idx];
           break;
         case parquet::Type::INT96:
           // it is further adjusted in the R code, so that we can have
           // the same adjustments as for TIMESTAMPs
           NUMERIC_POINTER(dest)
-          [row_idx + dest_offset] = impala_timestamp_to_nanoseconds(
+          [dest_idx] = impala_timestamp_to_nanoseconds(
                                         ((Int96 *)col.data.ptr)[row_idx]) /
                                     1000000;
           break;
 
         case parquet::Type::FIXED_LEN_BYTE_ARRAY:
         case parquet::Type::BYTE_ARRAY: {
-          auto &s_ele = f.columns[col_idx]->schema_element;
+          auto &s_ele = col.col->schema_element;
           switch(TYPEOF(dest)) {
           case REALSXP: {
-            auto type_len = ((pair<uint32_t, char*>*) col.data.ptr)[row_idx].first;
-            auto bytes = ((pair<uint32_t, char*>*) col.data.ptr)[row_idx].second;
+            auto dec = str_value(col, row_idx, dict_range);
+            auto type_len = dec.first;
+            auto bytes = dec.second;
             int64_t val = 0;
             for (auto i = 0; i < type_len; i++) {
               val = val << ((type_len - i) * 8) | (uint8_t)bytes[i];
             }
 
             NUMERIC_POINTER(dest)
-              [row_idx + dest_offset] = val / pow(10.0, s_ele->scale);
+              [dest_idx] = val / pow(10.0, s_ele->scale);
             break;
           }
           case STRSXP: {
-            uint32_t len = ((pair<uint32_t, char*>*) col.data.ptr)[row_idx].first;
             if (s_ele->__isset.logicalType && s_ele->logicalType.__isset.UUID) {
-              if (len != 16) {
+              auto val = str_value(col, row_idx, dict_range);
+              if (val.first != 16) {
                 throw runtime_error("UUID column with length != 16 is not allowed in Parquet file");
               }
               char uuid[37];
-              const unsigned char *s = (const unsigned char*) (((pair<uint32_t, char*>*) col.data.ptr)[row_idx].second);
-
-              snprintf(
-                uuid, 37,
-                "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-                s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8], s[9],
-                s[10], s[11], s[12], s[13], s[14], s[15]
+              format_uuid(val.second, uuid);
+              SET_STRING_ELT(dest, dest_idx, safe_mkchar_len_utf8(uuid, 36, &uwtoken));
+            } else if (dict_strings != R_NilValue &&
+                       in_row_ranges(col.dict_rows, row_idx, dict_range)) {
+              SET_STRING_ELT(
+                dest, dest_idx,
+                STRING_ELT(dict_strings, dict_offsets[row_idx])
               );
-              SET_STRING_ELT(dest, row_idx + dest_offset, safe_mkchar_len_utf8(uuid, 36, &uwtoken));
             } else {
+              auto val = str_value(col, row_idx, dict_range);
               SET_STRING_ELT(
-                dest, row_idx + dest_offset,
-                safe_mkchar_len_utf8(
-                  ((pair<uint32_t, char *>*)col.data.ptr)[row_idx].second,
-                  len,
-                  &uwtoken
-                )
+                dest, dest_idx,
+                safe_mkchar_len_utf8(val.second, val.first, &uwtoken)
               );
             }
             break;
           }
+          case INTSXP: {
+            // factor
+            if (!fct->dict_map.empty() &&
+                in_row_ranges(col.dict_rows, row_idx, dict_range)) {
+              INTEGER(dest)[dest_idx] = fct->dict_map[dict_offsets[row_idx]];
+            } else {
+              auto val = str_value(col, row_idx, dict_range);
+              INTEGER(dest)[dest_idx] = fct->get(val.second, val.first);
+            }
+            break;
+          }
           case VECSXP: {
-            uint32_t len = ((pair<uint32_t, char*>*) col.data.ptr)[row_idx].first;
-            SEXP bts = PROTECT(safe_allocvector_raw(len, &uwtoken));
-            memcpy(RAW(bts), ((pair<uint32_t, char *>*)col.data.ptr)[row_idx].second, len);
-            SET_VECTOR_ELT(dest, row_idx + dest_offset, bts);
+            auto val = str_value(col, row_idx, dict_range);
+            SEXP bts = PROTECT(safe_allocvector_raw(val.first, &uwtoken));
+            memcpy(RAW(bts), val.second, val.first);
+            SET_VECTOR_ELT(dest, dest_idx, bts);
             UNPROTECT(1);
             break;
           }
@@ -375,7 +1014,7 @@ SEXP nanoparquet_read(SEXP filesxp) {
         }
         default: {
           auto it = parquet::_Type_VALUES_TO_NAMES.find(
-              f.columns[col_idx]->type);
+              col.col->type);
           string msg = string("nanoparquet_read: Unknown column type ") +
             it->second + " @ " __FILE__ ":" STR(__LINE__) " (" + __func__ + ")";
           throw msg;
@@ -383,16 +1022,136 @@ SEXP nanoparquet_read(SEXP filesxp) {
         }
       }
     }
-    dest_offset += rc.nrows;
+    dest_offset += rc.filtered ? rc.selected.size() : rc.row_to - rc.row_from;
   }
-  assert(dest_offset == nrows);
 
-  SEXP res = PROTECT(safe_allocvector_vec(3, &uwtoken));
+  // with a filter we allocated for the rows of all the row groups that
+  // might have matching rows, so we might need to shrink
+  if (!f.filter.empty() && dest_offset < nrows) {
+    for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+      if (compact[col_idx]) {
+        compact[col_idx]->rows.resize(dest_offset);
+        continue;
+      }
+      SEXP old = VECTOR_ELT(retlist, col_idx);
+      SEXP nv = PROTECT(safe_xlengthgets(old, dest_offset, &uwtoken));
+      safe_copymostattrib(old, nv, &uwtoken);
+      SET_VECTOR_ELT(retlist, col_idx, nv);
+      UNPROTECT(1);
+    }
+  }
+
+  // The index of a compact column is 1, 2 or 4 bytes per row. If that
+  // is not smaller than the column itself, we create a regular vector.
+  for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+    CompactColumn *cmp = compact[col_idx].get();
+    if (!cmp) continue;
+    SEXP proto = VECTOR_ELT(retlist, col_idx);
+    auto &values = cmp->values;
+    SEXP vals = PROTECT(safe_allocvector_like(proto, values.size(), &uwtoken));
+    for (size_t i = 0; i < values.size(); i++) {
+      switch (TYPEOF(vals)) {
+      case INTSXP:
+        memcpy(INTEGER(vals) + i, values[i].data(), sizeof(int));
+        break;
+      case REALSXP:
+        memcpy(REAL(vals) + i, values[i].data(), sizeof(double));
+        break;
+      default:
+        SET_STRING_ELT(
+          vals, i,
+          safe_mkchar_len_utf8(values[i].data(), values[i].size(), &uwtoken)
+        );
+        break;
+      }
+    }
+    // NaN is also missing in R
+    bool no_na = !cmp->has_na;
+    for (R_xlen_t i = 0; no_na && TYPEOF(vals) == REALSXP && i < XLENGTH(vals); i++) {
+      no_na = !ISNAN(REAL(vals)[i]);
+    }
+    int width = values.size() < 256 ? 1 : values.size() < 65536 ? 2 : 4;
+    int elt_size = TYPEOF(vals) == INTSXP ? sizeof(int) :
+      TYPEOF(vals) == REALSXP ? sizeof(double) : sizeof(SEXP);
+    uint64_t len = cmp->rows.size();
+    SEXP col;
+    if (width >= elt_size) {
+      col = PROTECT(safe_allocvector_like(proto, len, &uwtoken));
+      for (uint64_t i = 0; i < len; i++) {
+        uint32_t idx = cmp->rows[i];
+        switch (TYPEOF(col)) {
+        case INTSXP:
+          INTEGER(col)[i] = idx == 0 ? NA_INTEGER : INTEGER(vals)[idx - 1];
+          break;
+        case REALSXP:
+          REAL(col)[i] = idx == 0 ? NA_REAL : REAL(vals)[idx - 1];
+          break;
+        default:
+          SET_STRING_ELT(col, i, idx == 0 ? NA_STRING : STRING_ELT(vals, idx - 1));
+          break;
+        }
+      }
+      safe_copymostattrib(proto, col, &uwtoken);
+    } else {
+      SEXP idx = PROTECT(safe_allocvector_raw(len * width, &uwtoken));
+      for (uint64_t i = 0; i < len; i++) {
+        switch (width) {
+        case 1:
+          RAW(idx)[i] = cmp->rows[i];
+          break;
+        case 2:
+          ((uint16_t *) RAW(idx))[i] = cmp->rows[i];
+          break;
+        default:
+          ((uint32_t *) RAW(idx))[i] = cmp->rows[i];
+          break;
+        }
+      }
+      SEXP info = PROTECT(safe_allocvector_vec(4, &uwtoken));
+      SET_VECTOR_ELT(info, 0, vals);
+      SET_VECTOR_ELT(info, 1, idx);
+      SET_VECTOR_ELT(info, 2, safe_scalarinteger(width, &uwtoken));
+      SET_VECTOR_ELT(info, 3, safe_scalarlogical(no_na, &uwtoken));
+      col = safe_dict_column(proto, info, &uwtoken);
+      UNPROTECT(2);
+      PROTECT(col);
+    }
+    SET_VECTOR_ELT(retlist, col_idx, col);
+    compact[col_idx].reset();
+    UNPROTECT(2); // col, vals
+  }
+
+  for (size_t col_idx = 0; col_idx < ncols; col_idx++) {
+    if (!factors[col_idx]) continue;
+    auto &levels = factors[col_idx]->levels;
+    SEXP lv = PROTECT(safe_allocvector_str(levels.size(), &uwtoken));
+    for (size_t i = 0; i < levels.size(); i++) {
+      SET_STRING_ELT(
+        lv, i,
+        safe_mkchar_len_utf8(levels[i].data(), levels[i].size(), &uwtoken)
+      );
+    }
+    safe_setattrib(VECTOR_ELT(retlist, col_idx), R_LevelsSymbol, lv, &uwtoken);
+    SET_VECTOR_ELT(dicts, col_idx, lv);
+    UNPROTECT(1);
+  }
+
+  SEXP stats = PROTECT(safe_allocvector_real(7, &uwtoken));
+  REAL(stats)[0] = f.read_stats.num_chunks;
+  REAL(stats)[1] = f.read_stats.num_reads;
+  REAL(stats)[2] = f.read_stats.bytes_read;
+  REAL(stats)[3] = f.read_stats.row_groups_pruned;
+  REAL(stats)[4] = f.read_stats.pages_pruned;
+  REAL(stats)[5] = f.read_stats.pages_decoded;
+  REAL(stats)[6] = f.read_stats.pages_skipped;
+
+  SEXP res = PROTECT(safe_allocvector_vec(4, &uwtoken));
   SET_VECTOR_ELT(res, 0, retlist);
   SET_VECTOR_ELT(res, 1, dicts);
   SET_VECTOR_ELT(res, 2, types);
+  SET_VECTOR_ELT(res, 3, stats);
 
-  UNPROTECT(5); // + retlist, dicts, types, uwtoken
+  UNPROTECT(7); // + retlist, dicts, types, lazy_prot, stats, uwtoken
   return res;
   R_API_END();
 }
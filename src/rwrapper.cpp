@@ -1,8 +1,11 @@
 #include <Rdefines.h>
+#include "altrep.h"
 
 extern "C" {
 
-SEXP nanoparquet_read(SEXP filesxp);
+SEXP nanoparquet_read(SEXP filesxp, SEXP colsel, SEXP rowgroups,
+                      SEXP skip, SEXP nmax, SEXP filter, SEXP factors,
+                      SEXP eager, SEXP options);
 SEXP nanoparquet_write(
   SEXP dfsxp,
   SEXP filesxp,
@@ -77,7 +80,7 @@ SEXP is_ubsan_() {
   { #name, (DL_FUNC)&name, n }
 
 static const R_CallMethodDef R_CallDef[] = {
-  CALLDEF(nanoparquet_read, 1),
+  CALLDEF(nanoparquet_read, 9),
   CALLDEF(nanoparquet_write, 6),
   CALLDEF(nanoparquet_read_metadata, 1),
   CALLDEF(nanoparquet_read_schema, 1),
@@ -115,6 +118,7 @@ static const R_CallMethodDef R_CallDef[] = {
 void R_init_nanoparquet(DllInfo *dll) {
   R_registerRoutines(dll, NULL, R_CallDef, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
+  init_altrep(dll);
 }
 
 }
@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+# Writes the test files for the page index and bloom filter tests:
+# data/page-index.parquet and data/bloom.parquet. Run it from
+# tests/testthat:
+#
+#   python3 data-raw/filter-data.py
+#
+# This is a minimal Parquet writer, because the usual writers cannot
+# write a page index and bloom filters together, with pages of a given
+# number of rows.
+
+import struct, zlib
+
+# ---- thrift compact ----
+def varint(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7f
+        n >>= 7
+        if n:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+def zz(n):
+    return (n << 1) ^ (n >> 63)
+
+class S:
+    """struct builder: fields list of (id, type, value)"""
+    def __init__(self, *fields):
+        self.fields = [f for f in fields if f is not None and f[2] is not None]
+
+T_BOOL_T, T_BOOL_F, T_BYTE, T_I16, T_I32, T_I64, T_DOUBLE, T_BIN, T_LIST, T_SET, T_MAP, T_STRUCT = 1,2,3,4,5,6,7,8,9,10,11,12
+
+def enc_val(t, v):
+    if t in (T_I16, T_I32, T_I64):
+        return varint(zz(v))
+    if t == T_BIN:
+        if isinstance(v, str): v = v.encode()
+        return varint(len(v)) + v
+    if t == T_STRUCT:
+        return enc_struct(v)
+    if t == T_LIST:
+        et, items = v
+        n = len(items)
+        hdr = bytes([(n << 4) | et]) if n < 15 else bytes([0xf0 | et]) + varint(n)
+        if et == T_BOOL_T:
+            return hdr + b''.join(bytes([1 if x else 2]) for x in items)
+        return hdr + b''.join(enc_val(et, x) for x in items)
+    raise Exception(t)
+
+def enc_struct(s):
+    out = bytearray()
+    last = 0
+    for fid, t, v in sorted(s.fields, key=lambda f: f[0]):
+        tt = t
+        if t == 'bool':
+            tt = T_BOOL_T if v else T_BOOL_F
+        d = fid - last
+        if 0 < d <= 15:
+            out.append((d << 4) | tt)
+        else:
+            out.append(tt)
+            out += varint(zz(fid))
+        last = fid
+        if t != 'bool':
+            out += enc_val(t, v)
+    out.append(0)
+    return bytes(out)
+
+# ---- xxhash64 ----
+P1 = 11400714785074694791; P2 = 14029467366897019727; P3 = 1609587929392839161
+P4 = 9650029242287828579; P5 = 2870177450012600261; M = (1 << 64) - 1
+def rotl(x, r): return ((x << r) | (x >> (64 - r))) & M
+def rnd(acc, inp):
+    acc = (acc + inp * P2) & M
+    acc = rotl(acc, 31)
+    return (acc * P1) & M
+def merge(acc, v):
+    acc ^= rnd(0, v)
+    return (acc * P1 + P4) & M
+def xxh64(data, seed=0):
+    n = len(data); i = 0
+    if n >= 32:
+        v1 = (seed + P1 + P2) & M; v2 = (seed + P2) & M; v3 = seed; v4 = (seed - P1) & M
+        while i + 32 <= n:
+            v1 = rnd(v1, struct.unpack_from('<Q', data, i)[0]); i += 8
+            v2 = rnd(v2, struct.unpack_from('<Q', data, i)[0]); i += 8
+            v3 = rnd(v3, struct.unpack_from('<Q', data, i)[0]); i += 8
+            v4 = rnd(v4, struct.unpack_from('<Q', data, i)[0]); i += 8
+        h = (rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18)) & M
+        h = merge(h, v1); h = merge(h, v2); h = merge(h, v3); h = merge(h, v4)
+    else:
+        h = (seed + P5) & M
+    h = (h + n) & M
+    while i + 8 <= n:
+        k = rnd(0, struct.unpack_from('<Q', data, i)[0])
+        h ^= k
+        h = (rotl(h, 27) * P1 + P4) & M
+        i += 8
+    if i + 4 <= n:
+        h ^= (struct.unpack_from('<I', data, i)[0] * P1) & M
+        h = (rotl(h, 23) * P2 + P3) & M
+        i += 4
+    while i < n:
+        h ^= (data[i] * P5) & M
+        h = (rotl(h, 11) * P1) & M
+        i += 1
+    h ^= h >> 33; h = (h * P2) & M; h ^= h >> 29; h = (h * P3) & M; h ^= h >> 32
+    return h
+
+SALT = [0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31]
+def bloom_build(hashes, nbytes):
+    nblocks = nbytes // 32
+    words = [0] * (nblocks * 8)
+    for h in hashes:
+        b = ((h >> 32) * nblocks) >> 32
+        key = h & 0xffffffff
+        for j in range(8):
+            bit = ((key * SALT[j]) & 0xffffffff) >> 27
+            words[b * 8 + j] |= 1 << bit
+    return struct.pack('<%dI' % len(words), *words)
+
+# ---- parquet ----
+TYPES = {'BOOLEAN': 0, 'INT32': 1, 'INT64': 2, 'INT96': 3, 'FLOAT': 4, 'DOUBLE': 5, 'BYTE_ARRAY': 6, 'FIXED_LEN_BYTE_ARRAY': 7}
+PLAIN, PLAIN_DICT, RLE, RLE_DICT = 0, 2, 3, 8
+
+def plain(tname, vals):
+    if tname == 'INT32': return b''.join(struct.pack('<i', v) for v in vals)
+    if tname == 'INT64': return b''.join(struct.pack('<q', v) for v in vals)
+    if tname == 'DOUBLE': return b''.join(struct.pack('<d', v) for v in vals)
+    if tname == 'FLOAT': return b''.join(struct.pack('<f', v) for v in vals)
+    if tname == 'BYTE_ARRAY':
+        out = bytearray()
+        for v in vals:
+            b = v.encode() if isinstance(v, str) else v
+            out += struct.pack('<I', len(b)) + b
+        return bytes(out)
+    if tname == 'BOOLEAN':
+        out = bytearray((len(vals) + 7) // 8)
+        for i, v in enumerate(vals):
+            if v: out[i // 8] |= 1 << (i % 8)
+        return bytes(out)
+    raise Exception(tname)
+
+def stat_bytes(tname, v):
+    if tname == 'BYTE_ARRAY': return v.encode() if isinstance(v, str) else v
+    if tname == 'BOOLEAN': return bytes([1 if v else 0])
+    return plain(tname, [v])
+
+def hash_val(tname, v):
+    return xxh64(stat_bytes(tname, v) if tname != 'BOOLEAN' else plain(tname, [v]))
+
+def bitpack(vals, bw):
+    # literal runs of 8 values, LSB first
+    out = bytearray()
+    acc = 0; nb = 0
+    for v in vals:
+        acc |= v << nb; nb += bw
+        while nb >= 8:
+            out.append(acc & 0xff); acc >>= 8; nb -= 8
+    if nb > 0: out.append(acc & 0xff)
+    return bytes(out)
+
+def rle_hybrid(vals, bw, mode='mixed'):
+    """encode with RLE runs for repeats >= 8 and bit-packed otherwise"""
+    out = bytearray()
+    i = 0; n = len(vals)
+    bytew = (bw + 7) // 8
+    lit = []
+    def flush_lit():
+        nonlocal lit, out
+        if not lit: return
+        while len(lit) % 8: lit.append(0)
+        groups = len(lit) // 8
+        out += varint((groups << 1) | 1) + bitpack(lit, bw)
+        lit = []
+    while i < n:
+        j = i
+        while j < n and vals[j] == vals[i]: j += 1
+        run = j - i
+        if mode != 'bitpacked' and run >= 8 and len(lit) % 8 == 0:
+            flush_lit()
+            out += varint(run << 1) + vals[i].to_bytes(bytew, 'little')
+            i = j
+        else:
+            lit.append(vals[i]); i += 1
+    flush_lit()
+    return bytes(out)
+
+def bitwidth(n):
+    return max(n - 1, 0).bit_length() if n > 1 else (1 if n == 1 else 0)
+
+def write(path, cols, nrows, rg_size=None, page_rows=None, stats=True,
+          page_index=False, bloom=False, v2=False, codec=0, dict_cols=(),
+          created_by='filter-data.py'):
+    """cols: list of dict(name, type, values, optional)"""
+    rg_size = rg_size or nrows
+    page_rows = page_rows or rg_size
+    f = bytearray(b'PAR1')
+    row_groups = []
+    indexes = []  # (rg, col, ColumnIndex bytes, OffsetIndex bytes)
+    blooms = []
+    for rg_start in range(0, max(nrows, 1), rg_size):
+        rg_end = min(nrows, rg_start + rg_size)
+        chunks = []
+        rg_bytes = 0
+        for ci, c in enumerate(cols):
+            tname = c['type']
+            vals = c['values'][rg_start:rg_end]
+            opt = c.get('optional', any(v is None for v in c['values']))
+            use_dict = c['name'] in dict_cols
+            chunk_start = len(f)
+            dict_off = None
+            encs = [PLAIN, RLE]
+            if use_dict:
+                dvals = []
+                seen = {}
+                for v in vals:
+                    if v is not None and v not in seen:
+                        seen[v] = len(dvals); dvals.append(v)
+                payload = plain(tname, dvals)
+                comp = compress(codec, payload)
+                ph = S((1, T_I32, 2), (2, T_I32, len(payload)), (3, T_I32, len(comp)),
+                       (7, T_STRUCT, S((1, T_I32, len(dvals)), (2, T_I32, PLAIN))))
+                dict_off = len(f)
+                f += enc_struct(ph) + comp
+                encs = [PLAIN, RLE, RLE_DICT]
+            data_off = len(f)
+            page_locs = []
+            ci_null_pages, ci_min, ci_max, ci_nulls = [], [], [], []
+            for p0 in range(0, len(vals), page_rows):
+                pv = vals[p0:p0 + page_rows]
+                nn = [v for v in pv if v is not None]
+                deflv = b''
+                defs = [0 if v is None else 1 for v in pv]
+                if opt:
+                    deflv = rle_hybrid(defs, 1)
+                if use_dict:
+                    idx = [seen[v] for v in nn]
+                    bw = bitwidth(len(dvals))
+                    body = bytes([bw]) + rle_hybrid(idx, bw) if bw > 0 else bytes([0])
+                    enc = RLE_DICT
+                else:
+                    body = plain(tname, nn)
+                    enc = PLAIN
+                if v2:
+                    comp = compress(codec, body)
+                    payload_u = deflv + body
+                    dph = S((1, T_I32, len(pv)), (2, T_I32, len(pv) - len(nn)), (3, T_I32, len(pv)),
+                            (4, T_I32, enc), (5, T_I32, len(deflv)), (6, T_I32, 0))
+                    ph = S((1, T_I32, 3), (2, T_I32, len(payload_u)), (3, T_I32, len(deflv) + len(comp)),
+                           (8, T_STRUCT, dph))
+                    raw = deflv + comp
+                else:
+                    payload_u = (struct.pack('<I', len(deflv)) + deflv if opt else b'') + body
+                    comp = compress(codec, payload_u)
+                    dph = S((1, T_I32, len(pv)), (2, T_I32, enc), (3, T_I32, RLE), (4, T_I32, RLE))
+                    ph = S((1, T_I32, 0), (2, T_I32, len(payload_u)), (3, T_I32, len(comp)),
+                           (5, T_STRUCT, dph))
+                    raw = comp
+                page_locs.append((len(f), 0, p0))
+                hdr = enc_struct(ph)
+                page_locs[-1] = (len(f), len(hdr) + len(raw), p0)
+                f += hdr + raw
+                ci_null_pages.append(len(nn) == 0)
+                ci_min.append(stat_bytes(tname, min(nn)) if nn else b'')
+                ci_max.append(stat_bytes(tname, max(nn)) if nn else b'')
+                ci_nulls.append(len(pv) - len(nn))
+            chunk_len = len(f) - chunk_start
+            rg_bytes += chunk_len
+            nn = [v for v in vals if v is not None]
+            st = None
+            if stats:
+                st = S((3, T_I64, len(vals) - len(nn)),
+                       (5, T_BIN, stat_bytes(tname, max(nn)) if nn else None),
+                       (6, T_BIN, stat_bytes(tname, min(nn)) if nn else None))
+            md = S((1, T_I32, TYPES[tname]), (2, T_LIST, (T_I32, encs)),
+                   (3, T_LIST, (T_BIN, [c['name']])), (4, T_I32, codec),
+                   (5, T_I64, len(vals)), (6, T_I64, chunk_len), (7, T_I64, chunk_len),
+                   (9, T_I64, data_off), (11, T_I64, dict_off),
+                   (12, T_STRUCT, st))
+            chunk = {'md': md, 'file_offset': chunk_start}
+            chunks.append(chunk)
+            if page_index:
+                cidx = S((1, T_LIST, (T_BOOL_T, ci_null_pages)),
+                         (2, T_LIST, (T_BIN, ci_min)), (3, T_LIST, (T_BIN, ci_max)),
+                         (4, T_I32, 0), (5, T_LIST, (T_I64, ci_nulls)))
+                oidx = S((1, T_LIST, (T_STRUCT, [S((1, T_I64, o), (2, T_I32, l), (3, T_I64, r)) for o, l, r in page_locs])))
+                indexes.append((chunk, enc_struct(cidx), enc_struct(oidx)))
+            if bloom:
+                hs = set(hash_val(tname, v) for v in nn)
+                nbytes = 32 * max(1, (len(hs) * 8 // 256) + 1)
+                blooms.append((chunk, md, bloom_build(hs, nbytes)))
+        row_groups.append({'chunks': chunks, 'num_rows': rg_end - rg_start, 'bytes': rg_bytes})
+        if nrows == 0: break
+    for chunk, md, bits in blooms:
+        hdr = S((1, T_I32, len(bits)), (2, T_STRUCT, S((1, T_STRUCT, S()))),
+                (3, T_STRUCT, S((1, T_STRUCT, S()))), (4, T_STRUCT, S((1, T_STRUCT, S()))))
+        off = len(f)
+        f += enc_struct(hdr) + bits
+        md.fields.append((14, T_I64, off))
+        md.fields.append((15, T_I32, len(f) - off))
+    for chunk, cidx, oidx in indexes:
+        chunk['ci'] = (len(f), len(cidx)); f += cidx
+    for chunk, cidx, oidx in indexes:
+        chunk['oi'] = (len(f), len(oidx)); f += oidx
+    schema = [S((4, T_BIN, 'schema'), (5, T_I32, len(cols)))]
+    for c in cols:
+        opt = c.get('optional', any(v is None for v in c['values']))
+        lt = None
+        ct = None
+        if c['type'] == 'BYTE_ARRAY' and c.get('string', True):
+            lt = S((1, T_STRUCT, S())); ct = 0
+        schema.append(S((1, T_I32, TYPES[c['type']]), (3, T_I32, 1 if opt else 0),
+                        (4, T_BIN, c['name']), (6, T_I32, ct), (10, T_STRUCT, lt)))
+    rgs = []
+    for rg in row_groups:
+        ccs = []
+        for ch in rg['chunks']:
+            fl = [(2, T_I64, ch['file_offset']), (3, T_STRUCT, ch['md'])]
+            if 'oi' in ch:
+                fl += [(4, T_I64, ch['oi'][0]), (5, T_I32, ch['oi'][1]), (6, T_I64, ch['ci'][0]), (7, T_I32, ch['ci'][1])]
+            ccs.append(S(*fl))
+        rgs.append(S((1, T_LIST, (T_STRUCT, ccs)), (2, T_I64, rg['bytes']), (3, T_I64, rg['num_rows'])))
+    fmd = S((1, T_I32, 1), (2, T_LIST, (T_STRUCT, schema)), (3, T_I64, nrows),
+            (4, T_LIST, (T_STRUCT, rgs)), (6, T_BIN, created_by))
+    footer = enc_struct(fmd)
+    f += footer + struct.pack('<I', len(footer)) + b'PAR1'
+    open(path, 'wb').write(f)
+
+def compress(codec, b):
+    if codec == 0: return b
+    if codec == 2:
+        c = zlib.compressobj(6, zlib.DEFLATED, 31)
+        return c.compress(b) + c.flush()
+    raise Exception('codec')
+
+if __name__ == '__main__':
+    # 1000 rows, one row group, ten pages of 100 rows in each column
+    n = 1000
+    cols = [
+        dict(name='id', type='INT32', values=list(range(1, n + 1))),
+        dict(name='str', type='BYTE_ARRAY',
+             values=['s%04d' % i for i in range(1, n + 1)]),
+        dict(name='val', type='DOUBLE',
+             values=[None if i % 10 == 0 else i / 2 for i in range(1, n + 1)]),
+    ]
+    write('data/page-index.parquet', cols, n, rg_size=n, page_rows=100,
+          page_index=True, created_by='nanoparquet test data')
+
+    # two row groups, with even ids 2 to 1000 and 1002 to 2000
+    cols = [
+        dict(name='id', type='INT32', values=[2 * i for i in range(1, n + 1)]),
+        dict(name='key', type='BYTE_ARRAY',
+             values=['k%05d' % (2 * i) for i in range(1, n + 1)]),
+    ]
+    write('data/bloom.parquet', cols, n, rg_size=500, bloom=True,
+          created_by='nanoparquet test data')